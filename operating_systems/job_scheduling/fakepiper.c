@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+fakepiper - a stand in for piper/piper used by the benchmark harness.
+It accepts the subset of the piper command line that jobsched uses,
+sleeps to simulate model loading and synthesis, and writes silence in
+proportion to the size of the input text.
+
+environment:
+    FAKEPIPER_LOAD_US   simulated model load time per process (default 40000)
+    FAKEPIPER_US_BYTE   simulated synthesis time per input byte (default 20)
+    FAKEPIPER_SAMPLES   samples written per input byte (default 64)
+    FAKEPIPER_CRASH     in --json-input mode, abort after this many requests
+                        to exercise crash recovery (default 0, never)
+    FAKEPIPER_KB_BYTE   memory touched per input byte while synthesizing, so
+                        peak RSS follows the input size (default 0)
+*/
+
+#define RATE 22050
+
+long load_us = 40000;
+long us_per_byte = 20;
+long samples_per_byte = 64;
+long crash_after = 0;
+long kb_per_byte = 0;
+
+long env_long(char * name, long def) {
+    char * val = getenv(name);
+    if (!val) return def;
+    return atol(val);
+}
+
+void put32(unsigned char * p, uint32_t v) {
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+void put16(unsigned char * p, uint16_t v) {
+    p[0] = v; p[1] = v >> 8;
+}
+
+void wav_header(unsigned char * h, uint32_t data_len) {
+    // canonical 44 byte PCM header, mono 16 bit
+    memcpy(h, "RIFF", 4);
+    put32(h + 4, 36 + data_len);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    put32(h + 16, 16);
+    put16(h + 20, 1);
+    put16(h + 22, 1);
+    put32(h + 24, RATE);
+    put32(h + 28, RATE * 2);
+    put16(h + 32, 2);
+    put16(h + 34, 16);
+    memcpy(h + 36, "data", 4);
+    put32(h + 40, data_len);
+}
+
+void synth_sleep(size_t bytes) {
+    // in 1 ms slices, so time spent stopped by SIGSTOP is not counted as work
+    // the working memory is held for the whole synthesis
+    size_t mem = (size_t) kb_per_byte * bytes * 1024;
+    char * work = mem ? malloc(mem) : NULL;
+    if (work) memset(work, 1, mem);
+    long us = us_per_byte * (long) bytes;
+    while (us > 0) {
+        long slice = us < 1000 ? us : 1000;
+        struct timespec ts = { 0, slice * 1000 };
+        nanosleep(&ts, NULL);
+        us -= slice;
+    }
+    free(work);
+}
+
+int write_wav(char * path, size_t bytes) {
+    // synthesize text of the given length into a wav file
+    FILE * out = fopen(path, "w");
+    if (!out) {
+        fprintf(stderr, "fakepiper: unable to open %s\n", path);
+        return -1;
+    }
+    uint32_t data_len = bytes * samples_per_byte * 2;
+    unsigned char h[44];
+    wav_header(h, data_len);
+    fwrite(h, 1, sizeof(h), out);
+
+    synth_sleep(bytes);
+    char zero[4096] = {0};
+    size_t left = data_len;
+    while (left > 0) {
+        size_t n = left < sizeof(zero) ? left : sizeof(zero);
+        fwrite(zero, 1, n, out);
+        left -= n;
+    }
+    fclose(out);
+    return 0;
+}
+
+char * json_string(char * line, char * key, size_t * len) {
+    // pull the value of "key" out of a single line json object
+    // returns a pointer into line and the escaped length of the value
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\"", key);
+    char * p = strstr(line, pattern);
+    if (!p) return NULL;
+    p = strchr(p + strlen(pattern), '"');
+    if (!p) return NULL;
+    p++;
+    char * q = p;
+    while (*q && *q != '"') {
+        if (*q == '\\' && q[1]) q++;
+        q++;
+    }
+    *len = q - p;
+    return p;
+}
+
+int json_mode(void) {
+    // one synthesis per input line, the output path is echoed when done
+    char * line = NULL;
+    size_t cap = 0;
+    ssize_t n;
+    long served = 0;
+    while ((n = getline(&line, &cap, stdin)) > 0) {
+        if (crash_after > 0 && served++ == crash_after) abort();
+        size_t text_len, out_len;
+        char * text = json_string(line, "text", &text_len);
+        char * out = json_string(line, "output_file", &out_len);
+        if (!text || !out) continue;
+        out[out_len] = 0;
+        if (write_wav(out, text_len) == 0) {
+            printf("%s\n", out);
+            fflush(stdout);
+        }
+    }
+    free(line);
+    return 0;
+}
+
+int raw_mode(void) {
+    // stream raw samples to stdout as each line is synthesized
+    char * line = NULL;
+    size_t cap = 0;
+    ssize_t n;
+    char zero[4096] = {0};
+    while ((n = getline(&line, &cap, stdin)) > 0) {
+        synth_sleep(n);
+        size_t left = n * samples_per_byte * 2;
+        while (left > 0) {
+            size_t w = left < sizeof(zero) ? left : sizeof(zero);
+            if (fwrite(zero, 1, w, stdout) != w) return 1;
+            left -= w;
+        }
+        fflush(stdout);
+    }
+    free(line);
+    return 0;
+}
+
+int main(int argc, char ** argv) {
+    char * out_file = NULL;
+    int json = 0;
+    int raw = 0;
+
+    load_us = env_long("FAKEPIPER_LOAD_US", load_us);
+    us_per_byte = env_long("FAKEPIPER_US_BYTE", us_per_byte);
+    samples_per_byte = env_long("FAKEPIPER_SAMPLES", samples_per_byte);
+    crash_after = env_long("FAKEPIPER_CRASH", crash_after);
+    kb_per_byte = env_long("FAKEPIPER_KB_BYTE", kb_per_byte);
+
+    for (int i = 1; i < argc; i++) {
+        if ((!strcmp(argv[i], "-f") || !strcmp(argv[i], "--output_file")) && i + 1 < argc) {
+            out_file = argv[++i];
+        }
+        else if ((!strcmp(argv[i], "-m") || !strcmp(argv[i], "--model")) && i + 1 < argc) {
+            i++;
+        }
+        else if (!strcmp(argv[i], "--json-input")) {
+            json = 1;
+        }
+        else if (!strcmp(argv[i], "--output_raw") || !strcmp(argv[i], "--output-raw")) {
+            raw = 1;
+        }
+    }
+
+    // pretend to load the onnx model
+    struct timespec ts = { load_us / 1000000, (load_us % 1000000) * 1000 };
+    nanosleep(&ts, NULL);
+
+    if (json) return json_mode();
+    if (raw) return raw_mode();
+    if (!out_file) {
+        fprintf(stderr, "fakepiper: usage: fakepiper -m <model> -f <out.wav>\n");
+        return 1;
+    }
+
+    // plain mode reads all of stdin and writes one file
+    size_t bytes = 0;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), stdin)) > 0) bytes += n;
+    return write_wav(out_file, bytes) == 0 ? 0 : 1;
+}
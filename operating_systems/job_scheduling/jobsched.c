@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -7,787 +8,5237 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <limits.h>
+#include <spawn.h>
+#include <dirent.h>
+#include <glob.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+extern char ** environ;
 
 pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t  cond  = PTHREAD_COND_INITIALIZER;
+// idle workers sleep here, submit wakes exactly one per job
+pthread_cond_t  work_cond = PTHREAD_COND_INITIALIZER;
+// the pool manager sleeps here between checks, nthreads wakes it early
+pthread_cond_t  pool_cond = PTHREAD_COND_INITIALIZER;
+
+// where command output goes, the command loop points it at the session
+// whose command it is running. workers print to stdout
+FILE * reply;
+
+// numbers the part files of split jobs
+uint32_t part_seq;
 
 int MAX_INPUT_LEN = 500;
-int MAX_WORDS = 3;
+int MAX_WORDS = 6;
 
-typedef struct Job{
-    // job info
+// a wait or waitall the command loop has not answered yet
+// a wait is also on its job's list, and the thread that finishes or deletes
+// the job marks it and wakes the loop through Job_list->wake_fd
+typedef struct Waiter {
+    // the job waited on, 0 for waitall
     int jobid;
-    char * in_file;
-    time_t in_time;
-    size_t in_size;
+    // 0 while waiting, 1 once the job is done, -1 if it was deleted
+    int state;
+    // next waiter on the same job
+    struct Waiter * next;
+    // next unanswered wait of the session
+    struct Waiter * next_pending;
+} Waiter;
+
+// one stream of commands and the waits it has outstanding, stdin or a
+// client of the daemon socket
+#define SESSION_BUFFER 4096
+// a client with this much unsent output is not read until it catches up
+#define SESSION_BACKLOG (1 << 20)
+#define MAX_EVENTS 64
 
-    time_t start_time;
+// the command loop keeps sessions on short lists so an event costs the
+// same however many clients are connected: those with something new to
+// run or send, those with unanswered waits, and those it cannot poll.
+// each list owns one slot of Session->set_pos, like the job heaps
+#define SET_NONE SIZE_MAX
+#define SET_DIRTY 0
+#define SET_WAITING 1
+#define SET_UNPOLLED 2
 
-    char * out_file_name;
-    time_t out_time;
+typedef struct Session {
+    int fd;
+    int client;
+    // epoll refuses regular files, a stdin that is one is always readable
+    int pollable;
+    // bytes read but not yet run as commands, from in_start to in_len
+    char * in;
+    size_t in_start;
+    size_t in_len;
+    int input_open;
+    int quit;
+    // what the session is polled for
+    uint32_t events;
+    // command output, for a client it collects here until the socket takes it
+    FILE * out;
+    char * out_buf;
     size_t out_size;
-    
-    /*
-    store the status of a job:
-    -1 = waiting
-    0 = running
-    1 = done
-    */
-    int job_stat;
-    char * job_status;
-    // only used in balanced scheduling
-    int passed_over;
+    size_t out_sent;
+    // unanswered waits in the order they were asked
+    Waiter * pending;
+    Waiter * pending_tail;
+    // when set, commands after a wait are held until it is answered
+    int block;
+    // position in each of the command loop's lists, SET_NONE when not on it
+    size_t set_pos[3];
+} Session;
+
+typedef struct {
+    Session ** items;
+    size_t len;
+    size_t cap;
+    int slot;
+} Session_set;
+
+// where a job is, a single byte so a state change is a single store
+typedef enum {
+    JOB_WAITING,
+    JOB_RUNNING,
+    JOB_DONE,
+    // preempted, its piper is stopped
+    JOB_PAUSED
+} Job_state;
+
+char * state_names[] = {"WAITING", "RUNNING", "DONE", "PAUSED"};
+
+// longest output or part file name job_output() and job_input() make
+#define JOB_NAME_MAX 64
+
+// what a job's piper used: cpu time, peak resident memory and block i/o
+// own is set when the piper ran the job by itself. a pool or batch piper
+// serves many jobs, its cpu and i/o are split between them as they are
+// answered and its peak is its own peak so far
+typedef struct {
+    uint64_t cpu_ns;
+    uint32_t max_rss_kb;
+    uint32_t in_blocks;
+    uint32_t out_blocks;
+    char own;
+} Usage;
 
-    // pointer for linked list
+// fields are grouped by size so the record has no padding holes, and the
+// output name is derived from the id rather than stored
+typedef struct Job{
+    // interned, shared by every job naming the same file. NULL for a part,
+    // whose file name comes from part_file
+    const char * in_file;
+    // times are nanoseconds on the monotonic clock
+    uint64_t in_time;
+    uint64_t start_time;
+    uint64_t out_time;
+    // when the first audio could be played: the first samples piper
+    // streamed, or out_time when the wav only appears complete
+    uint64_t first_audio_time;
+    // time spent stopped by preemption, and when the current pause began
+    uint64_t paused_ns;
+    uint64_t paused_at;
+    // when the job should be done by, 0 for no deadline
+    uint64_t deadline;
+    // virtual start time the fair schedule orders by, see fair_tag()
+    uint64_t vstart;
+    // when the output was last used: the job finished or a wait reported it
+    uint64_t used_at;
+    size_t in_size;
+    size_t out_size;
+    // hash of the model and the input text, keys the output cache
+    uint64_t content_key;
+    // runtime in seconds the model predicted at submit
+    double predicted_run;
+    // predicted seconds of piper left when it was paused
+    double remaining;
+    // value of Run_queue->dispatched when the job was queued
+    size_t dispatch_stamp;
+    // filled in when the job finishes, summed over the parts of a split job
+    Usage usage;
+
+    // a large input split at sentence ends runs as parts, each a job that
+    // is queued but not listed or indexed. parts is freed once they are
+    // all done and joined, nparts stays for list
+    struct Job ** parts;
+    // set on a part: the job it belongs to
+    struct Job * parent;
+    // threads blocked in waitfor() on this job
+    Waiter * waiters;
+    // pointer for linked list, next also links free records in a slab
     struct Job * next;
     struct Job * prev; 
+
+    int jobid;
+    // text features counted at submit, they feed the runtime model
+    unsigned int sentences;
+    unsigned int punctuation;
+    unsigned int digits;
+    // piper child of a job running or paused in exec mode, so it can be
+    // stopped and continued. only valid while run_slot >= 0 or paused
+    pid_t pid;
+    // position in Job_list->running, -1 when it cannot be preempted
+    int run_slot;
+    // only used in balanced scheduling
+    int passed_over;
+    // run queue holding the job while it waits, -1 for the shared one
+    int runq;
+    // times the job was preempted
+    int preemptions;
+    int nparts;
+    int parts_left;
+    // on a part: its place in the output and the number in its file names
+    int part;
+    uint32_t part_file;
+    // position in each of the waiting heaps, HEAP_NONE when not queued
+    uint32_t heap_pos[3];
+
+    // a Job_state
+    signed char state;
+    // the schedule in force when the job was dispatched, for stats
+    char policy;
+    // cleared if piper failed, so a partial wav is never cached
+    char cacheable;
+    // the output was streamed, and whether it went to a fifo
+    char streamed;
+    char fifo;
+    // a SIGSTOP has been sent and the worker has not seen it land yet
+    char stopping;
+    // predicted to need a lot of memory, queued in Run_queue->heavy and
+    // counted in heavy_running from when it starts until it finishes
+    char heavy;
+    // index into priority_names
+    char priority;
+    // index into Job_list->tenants
+    unsigned char tenant;
+    // submit linked a cached output to jobN.wav, admission just finishes it
+    char cached;
+    // the output is kept whatever the budget, or was removed to stay under it
+    char pinned;
+    char evicted;
 }Job;
 
+// jobs are carved out of slabs of this many records, so a million job
+// session makes a few hundred allocations and list walks records that
+// sit next to each other. released records are reused, slabs never shrink
+#define JOB_SLAB 4096
+
+typedef struct Job_slab {
+    struct Job_slab * next;
+    Job jobs[JOB_SLAB];
+} Job_slab;
+
+// input paths are interned into blocks of this many bytes
+#define INTERN_BLOCK 65536
+
+// the job slabs and the interned paths, shared by bulk submit threads
+pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
+Job_slab * slabs;
+Job * free_jobs;
+// open addressing set of interned paths, a power of two at most half full
+char ** interned;
+size_t interned_cap;
+size_t interned_count;
+// every block starts with a pointer to the one allocated before it
+char * intern_blocks;
+// where the next short path goes, and the room left there
+char * intern_fill;
+size_t intern_left;
+
+// scheduling policies, indexed by policy_index()
+#define POLICIES 5
+char * policy_names[POLICIES] = {"fcfs", "sjf", "balanced", "edf", "fair"};
+char policy_modes[POLICIES] = {'f', 's', 'b', 'e', 'q'};
+
+// priority classes given at submit, the lower the more urgent. edf runs
+// a whole band before the next and orders each band by deadline
+#define PRIORITIES 3
+#define PRIORITY_NORMAL 1
+char * priority_names[PRIORITIES] = {"interactive", "normal", "bulk"};
+
+// what submit was told about a job: how urgent it is and whose it is
+typedef struct {
+    char priority;
+    // seconds after submission the job should be done by, 0 for none
+    double deadline_s;
+    // index into Job_list->tenants
+    int tenant;
+} Submit_tags;
+
+// most jobs a worker will send to one piper run in batch mode
+#define BATCH_MAX 64
+
+// elastic worker pool
+// the most workers nthreads may ask for
+#define MAX_WORKERS 256
+// how often the pool manager checks whether to grow
+#define POOL_TICK_MS 100
+// how often a running piper's peak memory is read from /proc
+#define PEAK_SAMPLE_MS 10
+// a worker above the minimum that has been idle this long retires
+#define IDLE_RETIRE_S 5
+
+// online linear model of piper runtime, fit by recursive least squares
+// features are a constant, input kB, sentences/10, punctuation/100 and
+// digits/100. it starts out as 1 second per kB so an untrained model
+// orders jobs the same way sjf does
+#define FEATURES 5
+// older samples are forgotten at this rate so the model follows drift
+#define MODEL_FORGET 0.995
+
+typedef struct {
+    double w[FEATURES];
+    double P[FEATURES][FEATURES];
+    // completed jobs the model has learned from
+    size_t samples;
+    // sum of |predicted - actual| over those jobs, measured before learning
+    double abs_error;
+} Runtime_model;
+
+// the voice model every piper is started with
+#define PIPER_MODEL "arctic.onnx"
+// piper's own default, used when the model config cannot be read
+#define DEFAULT_SAMPLE_RATE 22050
+
+// finished outputs kept by content so resubmitted text is not synthesized
+// again. each entry is a hard link in CACHE_DIR named by its key in hex,
+// and a hit hard links it to the new jobN.wav
+#define CACHE_DIR "wavcache"
+#define CACHE_DEFAULT_MB 256
+// evicted cache files are removed this many at a time, with the lock released
+#define CACHE_EVICT_BATCH 64
+
+// finished outputs may take this many megabytes by default. over it the
+// workers stop until jobs are deleted, unless eviction of the least
+// recently used or the oldest unpinned ones is asked for
+#define OUTPUT_BUDGET_MB 100
+
+typedef struct Cache_entry {
+    uint64_t key;
+    size_t size;
+    // most recently used at the head
+    struct Cache_entry * prev;
+    struct Cache_entry * next;
+} Cache_entry;
+
+typedef struct {
+    // guards everything below. the files are linked and removed with it
+    // released, and it is taken inside the global mutex, never around it
+    pthread_mutex_t lock;
+    // open addressing table from key to entry, like the jobid index
+    Cache_entry ** table;
+    size_t cap;
+    size_t entries;
+    Cache_entry * head;
+    Cache_entry * tail;
+    size_t bytes;
+    // least recently used entries are evicted above this, 0 turns it off
+    size_t limit;
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+} Output_cache;
+
+// log bucketed latency histogram, values in microseconds
+// four buckets per power of two so a bucket is within 25% of its values,
+// and recording a value is a couple of instructions
+#define HIST_BUCKETS 168
+
+typedef struct {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+} Histogram;
+
+// the teams feeding jobsched tag their jobs at submit, and the fair schedule
+// divides worker time between them in proportion to their shares with start
+// time fair queuing. tenant 0 holds untagged jobs
+#define MAX_TENANTS 64
+#define TENANT_NAME_MAX 32
+#define DEFAULT_TENANT "default"
+
+typedef struct {
+    char name[TENANT_NAME_MAX];
+    double share;
+    // virtual time at which the tenant's last queued job is done
+    uint64_t finish;
+    // finished jobs and the piper time they took, the first submit and the
+    // last finish give the tenant's throughput
+    size_t done;
+    uint64_t run_ns;
+    uint64_t first_in;
+    uint64_t last_out;
+    Histogram response;
+    Histogram turnaround;
+} Tenant;
+
+// sums over the jobs in the list, kept up to date as jobs are admitted,
+// finish and are deleted so list prints its summary without walking them
+// the time sums are over DONE jobs, first audio over successful ones
+typedef struct {
+    size_t in_size;
+    uint64_t turnaround_ns;
+    uint64_t response_ns;
+    uint64_t paused_ns;
+    uint64_t first_audio_ns;
+    size_t audio_jobs;
+    uint64_t cpu_ns;
+    uint32_t peak_rss_kb;
+    size_t in_blocks;
+    size_t out_blocks;
+} Totals;
+
+// list copies at most this many jobs under the mutex at a time, looking at
+// no more than LIST_SCAN, and prints them after letting it go
+#define LIST_CHUNK 256
+#define LIST_SCAN 4096
+
+// which jobs list shows
+typedef struct {
+    // a Job_state, -1 for all of them
+    int state;
+    // ids from first to last, INT_MAX for no end
+    int first;
+    int last;
+    // stop after this many, 0 for no limit
+    size_t rows;
+    // only the summary lines
+    char summary;
+} List_filter;
+
+// a binary min heap of waiting jobs
+// each heap owns one slot of Job->heap_pos so jobs can be removed from the middle
+#define HEAP_NONE UINT32_MAX
+#define HEAP_READY 0
+#define HEAP_ARRIVAL 1
+#define HEAP_PAUSED 2
+// a finished job is never in an arrival heap, so the outputs heap shares its slot
+#define HEAP_DONE HEAP_ARRIVAL
+
+typedef struct {
+    Job ** items;
+    size_t len;
+    size_t cap;
+    int slot;
+    // returns nonzero if a should be dispatched before b
+    int (*before)(Job * a, Job * b);
+} Job_heap;
+
+// the waiting jobs that workers dispatch from
+// in shared dispatch there is a single one protected by the global mutex.
+// in steal dispatch every worker owns one protected by its own lock, and
+// idle workers pop from the others
+typedef struct {
+    pthread_mutex_t lock;
+    // waiting jobs only, ordered by the current schedule and by arrival
+    Job_heap ready;
+    Job_heap arrival;
+    // copy of the schedule, changed only with this queue locked
+    char mode;
+    // number of jobs handed to workers from this queue so far
+    size_t dispatched;
+    // memory heavy waiting jobs, ordered like ready but kept apart so they
+    // can be held back while heavy_cap of them are running. only the
+    // shared queue has any, heavy_cap 0 is no cap
+    Job_heap heavy;
+    int heavy_cap;
+    int heavy_running;
+} Run_queue;
+
 typedef struct {
     // head of the doubly linked list
+    // the list keeps every job in submission order for list/wait/delete
     Job * head;
     Job * tail;
 
+    // open addressing hash table from jobid to job, linear probing
+    // index_cap is always a power of two and kept at most half full
+    Job ** index;
+    size_t index_cap;
+
+    Run_queue shared;
+    // per worker run queues, only used in steal dispatch
+    // allocated for MAX_WORKERS up front, nrunq of them are in use
+    Run_queue * runq;
+    int nrunq;
+    // round robin position for placing submitted jobs
+    size_t next_runq;
+    // s for one shared run queue, w for per worker queues with stealing
+    // fixed once nthreads has started the workers
+    char dispatch;
+    // time workers spent getting jobs out of the run queues
+    size_t sched_ns;
+    size_t sched_jobs;
+
+    // f for fcfs, s for sjf, b for balanced, e for edf, q for fair
+    char mode;
+    // shortest remaining time preemption, sjf and balanced in shared dispatch
+    int preempt;
+    // inputs of at least twice this many bytes are split into parts, 0 is off
+    // only in shared dispatch
+    size_t split_bytes;
+    // exec mode jobs whose piper may be stopped, and the paused ones
+    // ordered by predicted time left
+    Job * running[MAX_WORKERS];
+    int nrunning;
+    Job_heap paused;
+    // SIGSTOPs sent that workers have not seen land yet
+    int stopping;
+    size_t preemptions;
+    // sjf and balanced rank jobs by predicted runtime instead of size
+    int predict;
+    Runtime_model model;
+    Output_cache cache;
+
+    // response and turnaround times of finished jobs per policy
+    Histogram response_hist[POLICIES];
+    Histogram turnaround_hist[POLICIES];
+    // time preempted jobs spent paused, kept apart from the other two
+    Histogram paused_hist[POLICIES];
+    // finished jobs that had a deadline, and those done after it, per class
+    size_t deadline_jobs[PRIORITIES];
+    size_t deadline_missed[PRIORITIES];
+    // tenants are only added by the command loop thread, their shares and
+    // stats are changed with the mutex held
+    Tenant tenants[MAX_TENANTS];
+    int ntenants;
+    // the fair schedule's virtual time, the largest vstart dispatched so far
+    // advanced with a compare and swap, steal workers do not hold the mutex
+    uint64_t vtime;
+    // submit to the first playable audio of successful jobs
+    Histogram first_audio_hist[POLICIES];
+    // what finished jobs used, rss in KB and i/o in blocks
+    Histogram cpu_hist[POLICIES];
+    Histogram rss_hist[POLICIES];
+    Histogram io_hist[POLICIES];
+    // least squares line of peak RSS in KB over input bytes, learned from
+    // jobs that ran on their own piper
+    double rss_n;
+    double rss_sx;
+    double rss_sy;
+    double rss_sxx;
+    double rss_sxy;
+    // jobs predicted to peak at or above this many KB are memory heavy, at
+    // most shared.heavy_cap of them run at once. shared dispatch only
+    size_t heavy_kb;
+    // realtime minus monotonic clock, to print job times as dates
+    uint64_t wall_offset;
+    // e to fork piper for every job, p to keep a piper per worker
+    char launch;
+    // exec mode jobs stream piper's raw samples into their output
+    int stream;
+    // of the voice model, from its json config
+    uint32_t sample_rate;
+    // piper processes started, so the pool savings show up in list
+    size_t spawns;
+    // micro batching per policy, 0 jobs means off
+    // small jobs are combined up to this many bytes and jobs per piper run
+    size_t batch_bytes[POLICIES];
+    int batch_jobs[POLICIES];
+    // piper runs that carried more than one job
+    size_t batches;
+
+    // taken with an atomic add at submit, so the id is known before the
+    // job is admitted
     size_t last_job_id;
+    // jobs submitted but not yet admitted: a lock free stack linked through
+    // Job->next, pushed by submit and emptied in one exchange by whoever
+    // next holds the mutex, see ingress_push() and ingress_drain()
+    Job * ingress;
+    // time submit spent handing jobs over, and how the ingress was drained
+    size_t enqueue_ns;
+    size_t enqueue_jobs;
+    size_t drains;
+    size_t drained;
     size_t count;
     size_t waiting;
     size_t done;
+    // changed under the mutex, but atomically as output_full() reads it
+    // without
     size_t total_output_size;
+    Totals totals;
+    // finished outputs take at most output_budget bytes, 0 for no limit
+    // evict is l to remove the least recently used outputs over it, a for
+    // the oldest, and s to stall the workers instead
+    size_t output_budget;
+    char evict;
+    // DONE jobs with an output that may be evicted, ordered by evict
+    Job_heap outputs;
+    size_t evictions;
+    size_t evicted_bytes;
+    size_t pinned;
+    // outputs evicted under the mutex, removed by evict_flush() after it
+    char (* victims)[JOB_NAME_MAX];
+    size_t nvictims;
+    size_t victims_cap;
+    // waitalls not yet answered
+    size_t all_waiters;
+    // eventfd the command loop polls, written when a wait can be answered
+    int wake_fd;
+
+    // elastic worker pool, bounds set by nthreads
+    int min_workers;
+    int max_workers;
+    // worker threads alive, and how many of them are asleep waiting for work
+    int live_workers;
+    int idle_workers;
+    // worker and manager threads that have not exited yet, and whether
+    // delete_queue has told them to
+    int threads;
+    int shutdown;
+    // ids handed to new workers, picks their run queue in steal dispatch
+    int next_worker_id;
+    // moving averages of recent response and run times in seconds
+    double recent_response;
+    double recent_run;
 } Job_list;
 
+// in balanced mode a job that has been passed over this many times runs next
+#define BALANCED_THRESHOLD 3
+
+// split inputs go to at most this many parts, written to PART_DIR
+#define SPLIT_MAX_PARTS 64
+#define PART_DIR "jobparts"
+
+// a running job is preempted for a waiting one predicted to take at most
+// this fraction of the time it has left
+#define PREEMPT_RATIO 4
+
+// a long lived piper child owned by one worker thread (piper pool mode)
+// jobs are written to it one json line at a time and piper answers each
+// line with the path of the wav it wrote, so the model is only loaded once
+typedef struct {
+    pid_t pid;
+    // write end of the child's stdin
+    int in;
+    // read end of the child's stdout
+    FILE * out;
+    // jobs this child has finished
+    size_t jobs;
+} Piper;
+
+// bulk submit prepares jobs on up to this many extra threads, the stat and
+// the pass over the text are mostly waiting on the disk
+#define BULK_THREADS 8
+
+// the file list a bulk submit shares between its threads
+typedef struct {
+    char ** names;
+    // filled in by index, NULL where the file could not be submitted
+    Job ** jobs;
+    size_t count;
+    // next name to take
+    size_t next;
+    // split size in force when the submit started
+    size_t split;
+} Bulk_work;
+
+// what each worker thread is started with
+typedef struct {
+    Job_list * queue;
+    int id;
+} Worker;
+
 // function declarations
-void * fcfs_worker(void * arg);
-void list_jobs( Job_list * queue);
-void nthreads(int threads, Job_list * queue, char mode);
+void * worker(void * arg);
+void list_jobs(Job_list * queue, List_filter * filter);
+size_t list_chunk(Job_list * queue, List_filter * filter, Job * rows, int * next);
+void list_row(Job_list * queue, Job * curr, uint64_t now);
+void totals_done(Job_list * queue, Job * job, int sign);
+int output_full(Job_list * queue);
+void output_kept(Job_list * queue, Job * job);
+void output_used(Job_list * queue, Job * job);
+void evict_outputs(Job_list * queue);
+void evict_flush(Job_list * queue);
+int set_pinned(Job_list * queue, int jobid, int pin);
+void nthreads(int min, int max, Job_list * queue);
+void * pool_manager(void * arg);
+int start_worker(Job_list * queue);
 void delete_queue(Job_list * queue);
-size_t file_size(char * filename);
-int submit (char * filename, Job_list * queue);
-int process(Job * work);
-void waitfor(Job_list * queue, int jobid);
-void wait_all(Job_list * queue);
+size_t file_size(const char * filename);
+int submit (char * filename, Job_list * queue, Submit_tags * tags);
+int submit_many(char * spec, Job_list * queue, Submit_tags * tags);
+void set_tags(Job * job, Submit_tags * tags);
+int tenant_find(Job_list * queue, const char * name, int add);
+void fair_tag(Job_list * queue, Job * job);
+int is_bulk(char * spec);
+Job * job_prepare(char * filename, size_t split);
+Job * job_alloc(void);
+void job_release(Job * job);
+void job_init(Job * job);
+const char * intern(const char * path);
+void store_free(void);
+char * job_output(Job * job, char * buf);
+const char * job_input(Job * job, char * buf);
+int job_split(Job * parent, size_t split);
+void parts_free(Job ** parts, int n);
+void parts_unlink(Job ** parts, int n);
+int wav_concat(Job * parent);
+void part_finish(Job_list * queue, Job * part);
+int job_admit(Job_list * queue, Job * new);
+void ingress_push(Job_list * queue, Job * job);
+size_t ingress_drain(Job_list * queue);
+int process(Job_list * queue, Job * work);
+int piper_wait(Job_list * queue, Job * work);
+int process_stream(Job_list * queue, Job * work);
+int write_all(int fd, char * buf, size_t len);
+uint32_t model_sample_rate(char * model);
+void pcm_format(unsigned char * fmt, uint32_t rate);
+void wav_header(unsigned char * header, unsigned char * fmt, uint32_t data);
+void preempt_check(Job_list * queue);
+Job * resume_job(Job_list * queue);
+int process_json(Job_list * queue, Piper * piper, Job ** jobs, int n);
+void finish_job(Job_list * queue, Job * work);
+void show_stats(Job_list * queue);
+int next_batch(Job_list * queue, Run_queue * rq, Job ** batch);
+int take_batch(Job_list * queue, Run_queue * rq, Job ** batch);
+int policy_index(char mode);
+int piper_start(Job_list * queue, Piper * piper);
+void piper_stop(Piper * piper);
+void waitfor(Job_list * queue, Session * session, int jobid);
+void wait_all(Job_list * queue, Session * session);
+void answer_waits(Job_list * queue, Session * session);
+void wake_loop(Job_list * queue);
+void session_init(Session * session, int fd, int client);
+void session_read(Session * session);
+int session_run(Job_list * queue, Session * session);
+void session_free(Job_list * queue, Session * session);
+int set_add(Session_set * set, Session * session);
+void set_remove(Session_set * set, Session * session);
+void command_loop(Job_list * queue, int listen_fd);
+int daemon_socket(char * path, struct stat * made);
+int run_command(Job_list * queue, Session * session, char * input);
 int delete(Job_list * queue, int jobid);
-void * sjf_worker(void * arg);
-void * balanced_worker(void * arg);
+void notify_waiters(Job_list * queue, Job * job, int state);
+void set_schedule(Job_list * queue, char mode);
+Job * next_job(Job_list * queue, Run_queue * rq);
+void runq_init(Run_queue * rq, char mode, int predict);
+int (*ready_order(char mode, int predict))(Job * a, Job * b);
+void job_features(Job * job, const char * path);
+double model_predict(Runtime_model * model, Job * job);
+void model_learn(Runtime_model * model, Job * job);
+int runq_push(Run_queue * rq, Job * job);
+void runq_remove(Run_queue * rq, Job * job);
+Job * ready_top(Run_queue * rq);
+size_t runnable_jobs(Job_list * queue);
+void set_memcap(Job_list * queue, int jobs, size_t kb);
+void heavy_done(Job_list * queue, Job * job);
+double rss_predict(Job_list * queue, Job * job);
+void rss_learn(Job_list * queue, Job * job);
+void usage_from_rusage(Usage * usage, struct rusage * ru);
+int proc_usage(pid_t pid, Usage * usage);
+uint32_t proc_peak_kb(pid_t pid);
+void peak_watch(pid_t pid, uint32_t * peak_kb);
+void usage_add(Usage * total, Usage * part);
 
+void heap_init(Job_heap * heap, int slot, int (*before)(Job * a, Job * b));
+int heap_push(Job_heap * heap, Job * job);
+void heap_remove(Job_heap * heap, Job * job);
+void heap_rebuild(Job_heap * heap, int (*before)(Job * a, Job * b));
+void heap_free(Job_heap * heap);
 
-int delete(Job_list * queue, int jobid) {
-    // deletes the job with the specified jobid
-    // acquire lock
-    Job * curr;
-    pthread_mutex_lock(&mutex);
+void cache_load(Output_cache * cache);
+int cache_lookup(Output_cache * cache, Job * job);
+void cache_store(Output_cache * cache, Job * job, size_t size);
+size_t cache_evict(Output_cache * cache, uint64_t * keys, size_t max);
+void cache_trim(Output_cache * cache);
+void cache_free(Output_cache * cache);
 
-    // find the job
-    curr = queue->head;
-    while (curr) {
-        if (jobid == curr->jobid) break;
-        curr = curr->next;
-    }
+int index_insert(Job_list * queue, Job * job);
+Job * index_find(Job_list * queue, int jobid);
+void index_remove(Job_list * queue, int jobid);
 
-    // handle missing job
-    if (!curr) {
-        printf("jobsched-delete: unable to find job with id: %d. No job was deleted.\n", jobid);
-        pthread_mutex_unlock(&mutex);
-        return -1;
-    }
-    else if (curr->job_stat == 0) {
-        printf("jobsched-delete: Job %d is currently running, and cannot be deleted!!\n", jobid);
-        pthread_mutex_unlock(&mutex);
-        return -1;
-    }
+int by_arrival(Job * a, Job * b) {
+    // the parts of a split job share its id and go in order
+    if (a->jobid != b->jobid) return a->jobid < b->jobid;
+    return a->part < b->part;
+}
 
-    // if the job is either waiting
-    if (curr->job_stat == -1) {
-        queue->waiting--;
-    }
-    // or done
-    else if (curr->job_stat == 1) {
-        queue->done--;
-        queue->total_output_size -= curr->out_size;
 
-        // remove the output file
-        if (remove(curr->out_file_name) < 0) {
-            printf("jobsched-delete: Error removing file %s: %s\n", curr->out_file_name, strerror(errno));
-            printf("jobsched-delete: still removing job %d\n", jobid);
-        }
-    }
-    // changes that are made every time
-    queue->count--;
-    // remove from the list 
-    if (curr == queue->head) {
-        queue->head = curr->next;
-    }
-    else if (queue->tail == curr) {
-        queue->tail = curr->prev;
-    }
-    if (curr->next) {
-        curr->next->prev = curr->prev;
-    }
-    if (curr->prev) {
-        curr->prev->next = curr->next;
-    }
+int by_size(Job * a, Job * b) {
+    // shortest first, ties go to the older job
+    if (a->in_size != b->in_size) return a->in_size < b->in_size;
+    return a->jobid < b->jobid;
+}
 
-    // remove node
-    free(curr);
-    printf("jobsched-delete: Job %d has been removed\n", jobid);
-    pthread_mutex_unlock(&mutex);
-    
-    return 0;
+int by_predicted(Job * a, Job * b) {
+    // shortest predicted runtime first, ties go to the older job
+    if (a->predicted_run != b->predicted_run) return a->predicted_run < b->predicted_run;
+    return a->jobid < b->jobid;
 }
 
-void wait_all(Job_list * queue) {
-    // waits for all the jobs 
+int by_remaining(Job * a, Job * b) {
+    // paused jobs, least predicted time left first
+    if (a->remaining != b->remaining) return a->remaining < b->remaining;
+    return a->jobid < b->jobid;
+}
 
-    pthread_mutex_lock(&mutex);
-    while (queue->done < queue->count) {
-        pthread_cond_wait(&cond, &mutex);
+int by_deadline(Job * a, Job * b) {
+    // edf within priority bands: the more urgent class first, then the
+    // earliest deadline with jobs that have none after the rest, then age
+    if (a->priority != b->priority) return a->priority < b->priority;
+    if (a->deadline != b->deadline) {
+        if (!a->deadline || !b->deadline) return a->deadline != 0;
+        return a->deadline < b->deadline;
     }
-    printf("All Jobs Are Done!!\n");
-    pthread_mutex_unlock(&mutex);
+    return by_arrival(a, b);
 }
 
-void waitfor(Job_list * queue, int jobid) {
-    // waits for a specific job and lists all of that information
-    Job * curr; 
+int by_share(Job * a, Job * b) {
+    // fair: the earliest virtual start, ties to the older job
+    if (a->vstart != b->vstart) return a->vstart < b->vstart;
+    return by_arrival(a, b);
+}
 
-    pthread_mutex_lock(&mutex);
-    // find the address of the job to check 
-    curr = queue->head;
-    while (curr) {
-        if (curr->jobid == jobid) break;
-        curr = curr->next;
-    }
-    if (!curr) {
-        printf("jobsched-wait: unable to find job %d\n", jobid);
-        return;
-    }
+int by_last_use(Job * a, Job * b) {
+    // outputs, least recently used first
+    if (a->used_at != b->used_at) return a->used_at < b->used_at;
+    return a->jobid < b->jobid;
+}
 
-    // wait for the job to be done 
-    while (curr->job_stat != 1) {
-        pthread_cond_wait(&cond, &mutex);
-    }
+int by_finished(Job * a, Job * b) {
+    // outputs, oldest first
+    if (a->out_time != b->out_time) return a->out_time < b->out_time;
+    return a->jobid < b->jobid;
+}
 
-    printf("Job %d was a ", jobid);
-    if (curr->out_size == 0) {
-        printf("Failure!\n");
-        return;
-    }
-    else {
-        printf("Success!\n");
-        printf("Job %d was submitted at: %s", jobid, ctime(&curr->in_time));
-        printf("Job %d started running at %s", jobid, ctime(&curr->start_time));
-        printf("Job %d finished at %s", jobid, ctime(&curr->out_time));
-    }
-    pthread_mutex_unlock(&mutex);
+int (*ready_order(char mode, int predict))(Job * a, Job * b) {
+    // the ready heap comparison for a schedule
+    if (mode == 'f') return by_arrival;
+    if (mode == 'e') return by_deadline;
+    if (mode == 'q') return by_share;
+    return predict ? by_predicted : by_size;
 }
 
-int process(Job * work) {
-    // do the actual work 
-    // can only read job values without mutex, not list pointers
-    // running status prevents other threads from changing things
+uint64_t now_ns(void) {
+    // monotonic clock, all job times are taken from it
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
 
-    pid_t new_pid = fork();
-    if (new_pid < 0) {
-        printf("jobsched-process: unable to fork: %s\n", strerror(errno));
-        return -1;
-    }
-    else if (new_pid == 0) {
-        // child process
-        // must redirect stdin
-        int file = open(work->in_file, 'r');
-        if (dup2(file, STDIN_FILENO) < 0) {
-            printf("jobsched-process: unable to redirect %s: %s\n", work->in_file, strerror(errno));
-        }
-        close(file);
+double run_seconds(Job * job) {
+    // how long piper spent on a finished job, not counting time paused
+    return (job->out_time - job->start_time - job->paused_ns) / 1e9;
+}
 
-        // redirect stdout 
-        file = open("/dev/null", 'w');
-        if (dup2(file, STDOUT_FILENO) < 0) {
-            printf("jobsched-process: unable to redirect stdout: %s\n", strerror(errno));
-        }
-        if (dup2(file, STDERR_FILENO) < 0) {
-            printf("jobsched-process: unable to redirect stderr: %s\n", strerror(errno));
-        }
-        close(file);
-        
-        execl("piper/piper", "piper", "-f", work->out_file_name, "-m", "arctic.onnx", NULL);
-    }
-    else {
-        int status;
-        waitpid(new_pid, &status, 0); 
+int hist_bucket(uint64_t us) {
+    if (us < 4) return us;
+    int msb = 63 - __builtin_clzll(us);
+    int bucket = (msb - 1) * 4 + ((us >> (msb - 2)) & 3);
+    return bucket < HIST_BUCKETS ? bucket : HIST_BUCKETS - 1;
+}
 
-        // handle weird exits
-        // if exited normally
-        if (WIFEXITED(status)) {
-            return 0;
-        }
-        else {
-            printf("jobsched-fcfs: process %d exited abnormally", new_pid);
-            if (WIFSIGNALED(status)) {
-                printf(" with signal %d", WTERMSIG(status));
-                return -1;
-            }
-            if (WCOREDUMP(status)) {
-                printf(": Segmentation Fault.");
-                return -1;
-            }
+uint64_t hist_bucket_top(int bucket) {
+    // largest value that lands in a bucket
+    if (bucket < 4) return bucket;
+    int msb = bucket / 4 + 1;
+    return ((uint64_t) (5 + bucket % 4) << (msb - 2)) - 1;
+}
+
+void hist_add(Histogram * hist, uint64_t ns) {
+    uint64_t us = ns / 1000;
+    hist->counts[hist_bucket(us)]++;
+    hist->total++;
+    if (us > hist->max) hist->max = us;
+}
+
+uint64_t hist_percentile(Histogram * hist, double p) {
+    // upper bound in microseconds of the value at percentile p
+    uint64_t rank = ceil(p * hist->total);
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist->counts[i];
+        if (seen >= rank) {
+            uint64_t top = hist_bucket_top(i);
+            return top < hist->max ? top : hist->max;
         }
     }
-    return 0;
+    return hist->max;
 }
 
-size_t file_size(char * filename) {
-    // return the filesize of a file
-    struct stat * st = malloc(sizeof(struct stat));
-     // get filesize
-    int e_num = lstat(filename, st);
-    if (e_num != 0) {
-            printf("jobsched: Unable to stat %s: %s\n", filename, strerror(errno));
-            free(st);
-            return 0;
+uint64_t fnv1a(uint64_t hash, const void * data, size_t len) {
+    // 64 bit FNV-1a, continues from hash
+    const unsigned char * bytes = data;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ull;
     }
-    size_t out = st->st_size;
-    free(st);
-    return out;
-
+    return hash;
 }
 
-int submit (char * filename, Job_list * queue) {
-    // pushes the filename to the struct
-    // first allocate and fill in the node and then push it to the linked list within
-    // the mutex
-    Job * new = malloc(sizeof(Job));
-
-    // copy name
-    new->in_file = strdup(filename);
-    if (!new->in_file) {
-        printf("jobsched-submit: error copying filename: %s", strerror(errno));
-        free(new);
-        return 1;
+void job_features(Job * job, const char * path) {
+    // count the text features the runtime model uses, and hash the text
+    // with the model name for the output cache in the same pass
+    job->sentences = job->punctuation = job->digits = 0;
+    job->content_key = fnv1a(0xcbf29ce484222325ull, PIPER_MODEL, sizeof(PIPER_MODEL));
+    FILE * file = fopen(path, "r");
+    if (!file) return;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), file)) > 0) {
+        job->content_key = fnv1a(job->content_key, buf, n);
+        for (size_t i = 0; i < n; i++) {
+            if (buf[i] == '.' || buf[i] == '!' || buf[i] == '?') job->sentences++;
+            else if (ispunct((unsigned char) buf[i])) job->punctuation++;
+            else if (isdigit((unsigned char) buf[i])) job->digits++;
+        }
     }
+    fclose(file);
+}
 
-    time(&new->in_time);
-    new->job_status = malloc(sizeof(char) * 10);
-    strcpy(new->job_status, "WAITING");
-    new->job_stat = -1;
+void model_vector(Job * job, double * x) {
+    x[0] = 1;
+    x[1] = job->in_size / 1000.0;
+    x[2] = job->sentences / 10.0;
+    x[3] = job->punctuation / 100.0;
+    x[4] = job->digits / 100.0;
+}
 
-    new->in_size = file_size(new->in_file);
-    // handle a file that doesn't exist
-    if (new->in_size == 0) {
-        printf("jobsched-submit: empty or non-existent file, not adding to queue\n");
-        free(new);
-        return 1;
+void model_init(Runtime_model * model) {
+    for (int i = 0; i < FEATURES; i++) {
+        model->w[i] = 0;
+        for (int j = 0; j < FEATURES; j++) {
+            model->P[i][j] = i == j ? 10 : 0;
+        }
     }
+    // prior: one second per kB of input
+    model->w[1] = 1;
+    model->samples = 0;
+    model->abs_error = 0;
+}
 
-    new->out_file_name = calloc(20, sizeof(char));
-    new->out_size = 0;
-    new->out_time = 0;
-    new->start_time = 0;
-    // for handling balanced sjf
-    new->passed_over = 0;
-
-    // push to list
-    pthread_mutex_lock(&mutex);
+double model_predict(Runtime_model * model, Job * job) {
+    double x[FEATURES];
+    model_vector(job, x);
+    double y = 0;
+    for (int i = 0; i < FEATURES; i++) y += model->w[i] * x[i];
+    // a runtime can't be negative whatever the fit says
+    return y > 0 ? y : 0;
+}
 
-    // doesn't matter how many jobs in queue always add one
-    // set jobid
-    queue->last_job_id++; 
-    new->jobid = queue->last_job_id;
+void model_learn(Runtime_model * model, Job * job) {
+    // one recursive least squares step with the job's actual runtime
+    double x[FEATURES], Px[FEATURES], k[FEATURES];
+    model_vector(job, x);
 
-    // handle empty list scenario
-    if (queue->count == 0) {
-        new->next = NULL;
-        new->prev = NULL;
-        queue->head = new;
-        queue->tail = new;
+    double denom = MODEL_FORGET;
+    for (int i = 0; i < FEATURES; i++) {
+        Px[i] = 0;
+        for (int j = 0; j < FEATURES; j++) Px[i] += model->P[i][j] * x[j];
+        denom += x[i] * Px[i];
     }
-    // add to a queue with stuff in it
-    else {
-        new->next = NULL;
-        queue->tail->next = new;
-        new->prev = queue->tail;
-        queue->tail = new;
-        
+    double err = run_seconds(job);
+    for (int i = 0; i < FEATURES; i++) {
+        k[i] = Px[i] / denom;
+        err -= model->w[i] * x[i];
     }
-    queue->count++;
-    queue->waiting++;
-    pthread_cond_broadcast(&cond);
-    pthread_mutex_unlock(&mutex);
-    
-    // print job id
-    printf("jobsched: Job %d started on file %s\n", new->jobid, new->in_file);
-
-    return 0;
-}
-
-void list_jobs( Job_list * queue) {
-    // list all of the jobs 
-
-    // for calculating summary stats
-    size_t total_in_size = 0;
-    // header 
-    printf("JOBID  STATE    INPUT_FILENAME  INPUT_SIZE  OUTPUT_FILE  OUTPUT_SIZE\n");
-    printf("____________________________________________________________________\n");
-    time_t turnaround = 0;
-    time_t response = 0;
-    size_t count = 0;
-    // lock the mutex 
-    pthread_mutex_lock(&mutex);
-    size_t output_size = queue->total_output_size;
-    Job * curr = queue->head;
-    while (curr) {
-        total_in_size += curr->in_size;
-        printf("%-7d%-9s%-16s%-9liB  %-13s%-10liB\n"
-                , curr->jobid, curr->job_status, curr->in_file, curr->in_size
-                , curr->out_file_name, curr->out_size);
-        
-        // handle done statistics
-        if (curr->job_stat == 1) {
-            turnaround += curr->out_time - curr->in_time;
-            response += curr->start_time - curr->in_time;
-            count++;
+    for (int i = 0; i < FEATURES; i++) {
+        model->w[i] += k[i] * err;
+        // P is symmetric so x^T P is Px
+        for (int j = 0; j < FEATURES; j++) {
+            model->P[i][j] = (model->P[i][j] - k[i] * Px[j]) / MODEL_FORGET;
         }
-        curr = curr->next;
-    }
-    pthread_mutex_unlock(&mutex);
-    printf("____________________________________________________________________\n");
-    printf("Total input file size: %li B\n", total_in_size);
-    printf("Total output file size: %li B\n", output_size);
-    if (count > 0) {
-        printf("Average turnaround time: %fs\n", (double) turnaround / count);
-        printf("Average response time: %fs\n", (double) response / count);
     }
+    model->abs_error += fabs(job->predicted_run - run_seconds(job));
+    model->samples++;
+}
 
+void heap_init(Job_heap * heap, int slot, int (*before)(Job * a, Job * b)) {
+    heap->items = NULL;
+    heap->len = 0;
+    heap->cap = 0;
+    heap->slot = slot;
+    heap->before = before;
 }
 
-void nthreads(int threads, Job_list * queue, char mode) {
-    // runs the threads necessary to create the files
-    // f for fcfs
-    // s for sjf
-    // b for balanced 
-    pthread_t * out = malloc(sizeof(pthread_t) * threads);
+void heap_place(Job_heap * heap, size_t i, Job * job) {
+    // store a job at index i and remember where it went
+    heap->items[i] = job;
+    job->heap_pos[heap->slot] = i;
+}
 
-    if (mode == 'f') {
-        for (int i = 0; i < threads; i++) {
-            pthread_create(&out[i], 0, fcfs_worker, queue);
-        }
+void heap_sift_up(Job_heap * heap, size_t i) {
+    Job * job = heap->items[i];
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!heap->before(job, heap->items[parent])) break;
+        heap_place(heap, i, heap->items[parent]);
+        i = parent;
     }
-    else if (mode == 's') {
-        for(int i = 0; i < threads; i++) {
-            pthread_create(&out[i], 0, sjf_worker, queue);
+    heap_place(heap, i, job);
+}
+
+void heap_sift_down(Job_heap * heap, size_t i) {
+    Job * job = heap->items[i];
+    while (1) {
+        size_t child = 2 * i + 1;
+        if (child >= heap->len) break;
+        if (child + 1 < heap->len && heap->before(heap->items[child + 1], heap->items[child])) {
+            child++;
         }
+        if (!heap->before(heap->items[child], job)) break;
+        heap_place(heap, i, heap->items[child]);
+        i = child;
     }
-    else if (mode == 'b') {
-        for(int i = 0; i < threads; i++) {
-            pthread_create(&out[i], 0, balanced_worker, queue);
+    heap_place(heap, i, job);
+}
+
+int heap_push(Job_heap * heap, Job * job) {
+    // add a job to the heap, O(log n)
+    if (heap->len == heap->cap) {
+        size_t cap = heap->cap ? heap->cap * 2 : 64;
+        Job ** items = realloc(heap->items, cap * sizeof(Job *));
+        if (!items) {
+            printf("jobsched-heap: unable to grow heap: %s\n", strerror(errno));
+            return -1;
         }
+        heap->items = items;
+        heap->cap = cap;
     }
-    free(out);
-    return;    
+    heap->items[heap->len] = job;
+    heap_sift_up(heap, heap->len++);
+    return 0;
 }
 
-void * fcfs_worker(void * arg) {
-    // worker thread function
-    Job_list * queue = arg;
-
-    Job * work;
+void heap_remove(Job_heap * heap, Job * job) {
+    // remove a job from anywhere in the heap, O(log n)
+    size_t i = job->heap_pos[heap->slot];
+    if (i == HEAP_NONE) return;
+    job->heap_pos[heap->slot] = HEAP_NONE;
 
-    while (1) {
-    // find an available job 
-    pthread_mutex_lock(&mutex);
-    while (queue->waiting <= 0 || queue->total_output_size >= (1<<20) * 100) {
-        pthread_cond_wait(&cond, &mutex);
-    }
-
-    // iterate through the queue and find the first available job
-    // they are in order of arrival
-    work = queue->head;
-    while (work) {
-        if (work->job_stat == -1) {
-            work->job_stat = 0;
-            strcpy(work->job_status, "RUNNING");
-            queue->waiting--;
-            break;
-        }
-        work = work->next;
+    Job * last = heap->items[--heap->len];
+    if (i == heap->len) return;
+    heap->items[i] = last;
+    if (i > 0 && heap->before(last, heap->items[(i - 1) / 2])) {
+        heap_sift_up(heap, i);
     }
-    if (!work) {
-        printf("jobsched-fcfsworker: unable to find job: exiting!\n");
-        return (void *)-1;
+    else {
+        heap_sift_down(heap, i);
     }
+}
 
-    sprintf(work->out_file_name, "job%d.wav", work->jobid);
+void heap_rebuild(Job_heap * heap, int (*before)(Job * a, Job * b)) {
+    // reorder the heap for a new comparison, O(n)
+    heap->before = before;
+    for (size_t i = heap->len / 2; i-- > 0; ) {
+        heap_sift_down(heap, i);
+    }
+}
 
-    pthread_mutex_unlock(&mutex);
+void heap_free(Job_heap * heap) {
+    free(heap->items);
+    heap->items = NULL;
+    heap->len = heap->cap = 0;
+}
 
-    // do the actual processing
-    time_t start;
-    time(&start);
-    process(work);
+size_t index_slot(Job_list * queue, int jobid) {
+    // multiplicative hash so consecutive ids spread across the table
+    return ((size_t) jobid * 2654435761u) & (queue->index_cap - 1);
+}
 
-    // update the values
-    pthread_mutex_lock(&mutex);
+int index_insert(Job_list * queue, Job * job) {
+    // add a job to the jobid index, must be called with the mutex held
+    // grow once the table would pass half full
+    if ((queue->count + 1) * 2 > queue->index_cap) {
+        size_t old_cap = queue->index_cap;
+        Job ** old = queue->index;
+        size_t cap = old_cap ? old_cap * 2 : 1024;
+        Job ** table = calloc(cap, sizeof(Job *));
+        if (!table) {
+            printf("jobsched-index: unable to grow index: %s\n", strerror(errno));
+            return -1;
+        }
+        queue->index = table;
+        queue->index_cap = cap;
+        for (size_t i = 0; i < old_cap; i++) {
+            if (!old[i]) continue;
+            size_t slot = index_slot(queue, old[i]->jobid);
+            while (table[slot]) slot = (slot + 1) & (cap - 1);
+            table[slot] = old[i];
+        }
+        free(old);
+    }
 
-    work->start_time = start;
-    time(&work->out_time);
-    work->out_size = file_size(work->out_file_name);
-    work->job_stat = 1;
-    strcpy(work->job_status, "DONE");
-    queue->total_output_size += work->out_size;
-    queue->done++;
+    size_t slot = index_slot(queue, job->jobid);
+    while (queue->index[slot]) slot = (slot + 1) & (queue->index_cap - 1);
+    queue->index[slot] = job;
+    return 0;
+}
 
-    pthread_cond_broadcast(&cond);
-    pthread_mutex_unlock(&mutex);
+Job * index_find(Job_list * queue, int jobid) {
+    // look up a job by id in O(1), must be called with the mutex held
+    if (queue->index_cap == 0) return NULL;
+    size_t slot = index_slot(queue, jobid);
+    while (queue->index[slot]) {
+        if (queue->index[slot]->jobid == jobid) return queue->index[slot];
+        slot = (slot + 1) & (queue->index_cap - 1);
     }
     return NULL;
 }
 
-void * sjf_worker(void * arg) {
-    // shortest job first worker
-    Job_list * queue = arg;
-    
-    while (1) {
-        // find available job
-        pthread_mutex_lock(&mutex);
-        while (queue->waiting <= 0 || queue->total_output_size >= (1<<20) * 100) {
-            pthread_cond_wait(&cond, &mutex);
-        } 
-
-        // iterate through queue
-        Job * curr = queue->head;
-        Job * shortest = NULL;
-        while (curr) {
-            // if job is waiting
-            if (curr->job_stat == -1) {
-                // if shortest hasn't been set yet
-                if (!shortest) {
-                    shortest = curr;
-                }
-                else if (curr->in_size < shortest->in_size) {
-                    shortest = curr;
-                }
-            }
-            curr = curr->next;
-        }       
+void index_remove(Job_list * queue, int jobid) {
+    // remove a job from the index, must be called with the mutex held
+    // entries after the hole are shifted back so no tombstones are needed
+    if (queue->index_cap == 0) return;
+    size_t mask = queue->index_cap - 1;
+    size_t hole = index_slot(queue, jobid);
+    while (queue->index[hole] && queue->index[hole]->jobid != jobid) {
+        hole = (hole + 1) & mask;
+    }
+    if (!queue->index[hole]) return;
 
-        if (!shortest) { 
-            printf("jobsched-sjf: unable to find job: EXITING!\n");
-            return (void*) -1;
+    size_t next = (hole + 1) & mask;
+    while (queue->index[next]) {
+        size_t home = index_slot(queue, queue->index[next]->jobid);
+        // move the entry back if its home is not between the hole and its slot
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            queue->index[hole] = queue->index[next];
+            hole = next;
         }
+        next = (next + 1) & mask;
+    }
+    queue->index[hole] = NULL;
+}
 
-        // start processing job 
-        sprintf(shortest->out_file_name, "job%d.wav", shortest->jobid);
-        shortest->job_stat = 0;
-        strcpy(shortest->job_status, "RUNNING");
-        queue->waiting--;
-        pthread_mutex_unlock(&mutex);
+void cache_path(char * path, uint64_t key) {
+    snprintf(path, 64, CACHE_DIR "/%016llx.wav", (unsigned long long) key);
+}
 
-        // do the actual processing
-        time_t start;
-        time(&start);
-        process(shortest);
+size_t cache_slot(Output_cache * cache, uint64_t key) {
+    // keys are already hashes, fold the high bits in for small tables
+    return (key ^ (key >> 32)) & (cache->cap - 1);
+}
+
+Cache_entry * cache_find(Output_cache * cache, uint64_t key) {
+    // must be called with the cache locked
+    if (cache->cap == 0) return NULL;
+    size_t slot = cache_slot(cache, key);
+    while (cache->table[slot]) {
+        if (cache->table[slot]->key == key) return cache->table[slot];
+        slot = (slot + 1) & (cache->cap - 1);
+    }
+    return NULL;
+}
+
+int cache_add(Output_cache * cache, uint64_t key, size_t size) {
+    // track a new entry at the head of the lru list
+    // grow once the table would pass half full
+    if ((cache->entries + 1) * 2 > cache->cap) {
+        size_t old_cap = cache->cap;
+        Cache_entry ** old = cache->table;
+        size_t cap = old_cap ? old_cap * 2 : 256;
+        Cache_entry ** table = calloc(cap, sizeof(Cache_entry *));
+        if (!table) return -1;
+        cache->table = table;
+        cache->cap = cap;
+        for (size_t i = 0; i < old_cap; i++) {
+            if (!old[i]) continue;
+            size_t slot = cache_slot(cache, old[i]->key);
+            while (table[slot]) slot = (slot + 1) & (cap - 1);
+            table[slot] = old[i];
+        }
+        free(old);
+    }
+    Cache_entry * entry = malloc(sizeof(Cache_entry));
+    if (!entry) return -1;
+    entry->key = key;
+    entry->size = size;
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head) cache->head->prev = entry;
+    else cache->tail = entry;
+    cache->head = entry;
+
+    size_t slot = cache_slot(cache, key);
+    while (cache->table[slot]) slot = (slot + 1) & (cache->cap - 1);
+    cache->table[slot] = entry;
+    cache->entries++;
+    cache->bytes += size;
+    return 0;
+}
+
+void cache_unlink_entry(Output_cache * cache, Cache_entry * entry) {
+    // take an entry out of the lru list
+    if (entry->prev) entry->prev->next = entry->next;
+    else cache->head = entry->next;
+    if (entry->next) entry->next->prev = entry->prev;
+    else cache->tail = entry->prev;
+}
+
+void cache_drop(Output_cache * cache, Cache_entry * entry) {
+    // forget an entry, the caller removes its file once the lock is released
+    // the table uses backward shift deletion like index_remove
+    size_t mask = cache->cap - 1;
+    size_t hole = cache_slot(cache, entry->key);
+    while (cache->table[hole] != entry) hole = (hole + 1) & mask;
+    size_t next = (hole + 1) & mask;
+    while (cache->table[next]) {
+        size_t home = cache_slot(cache, cache->table[next]->key);
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            cache->table[hole] = cache->table[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    cache->table[hole] = NULL;
+
+    cache_unlink_entry(cache, entry);
+    cache->entries--;
+    cache->bytes -= entry->size;
+    free(entry);
+}
+
+size_t cache_evict(Output_cache * cache, uint64_t * keys, size_t max) {
+    // drop up to max least recently used outputs while the cache is over
+    // its limit, must be called with the cache locked. returns how many,
+    // with their keys in keys for the caller to remove the files
+    size_t n = 0;
+    while (n < max && cache->tail && cache->bytes > cache->limit) {
+        keys[n++] = cache->tail->key;
+        cache_drop(cache, cache->tail);
+        cache->evictions++;
+    }
+    return n;
+}
+
+void cache_trim(Output_cache * cache) {
+    // evict until the cache fits its limit, the files are removed a batch
+    // at a time with the lock released
+    uint64_t keys[CACHE_EVICT_BATCH];
+    size_t n;
+    do {
+        pthread_mutex_lock(&cache->lock);
+        n = cache_evict(cache, keys, CACHE_EVICT_BATCH);
+        pthread_mutex_unlock(&cache->lock);
+        for (size_t i = 0; i < n; i++) {
+            char path[64];
+            cache_path(path, keys[i]);
+            unlink(path);
+        }
+    } while (n == CACHE_EVICT_BATCH);
+}
+
+// a cached file found on disk at startup
+typedef struct {
+    uint64_t key;
+    size_t size;
+    struct timespec used;
+} Cache_file;
+
+int by_used(const void * a, const void * b) {
+    // oldest first, for rebuilding the lru order
+    const Cache_file * x = a;
+    const Cache_file * y = b;
+    if (x->used.tv_sec != y->used.tv_sec) return x->used.tv_sec < y->used.tv_sec ? -1 : 1;
+    if (x->used.tv_nsec != y->used.tv_nsec) return x->used.tv_nsec < y->used.tv_nsec ? -1 : 1;
+    return 0;
+}
+
+void cache_load(Output_cache * cache) {
+    // pick up the outputs cached by earlier runs
+    // every store and hit makes a new link, which updates the file's ctime,
+    // so ctime order is the lru order
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->table = NULL;
+    cache->cap = 0;
+    cache->entries = 0;
+    cache->head = NULL;
+    cache->tail = NULL;
+    cache->bytes = 0;
+    cache->limit = (size_t) CACHE_DEFAULT_MB << 20;
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->evictions = 0;
+
+    if (mkdir(CACHE_DIR, 0755) < 0 && errno != EEXIST) {
+        printf("jobsched-cache: unable to create %s: %s\n", CACHE_DIR, strerror(errno));
+        cache->limit = 0;
+        return;
+    }
+    DIR * dir = opendir(CACHE_DIR);
+    if (!dir) return;
+
+    Cache_file * found = NULL;
+    size_t count = 0;
+    size_t cap = 0;
+    struct dirent * ent;
+    while ((ent = readdir(dir))) {
+        unsigned long long key;
+        char tail[8];
+        if (strlen(ent->d_name) != 20 || sscanf(ent->d_name, "%16llx%7s", &key, tail) != 2
+                || strcmp(tail, ".wav")) {
+            continue;
+        }
+        char path[64];
+        cache_path(path, key);
+        struct stat st;
+        if (stat(path, &st) < 0) continue;
+        if (count == cap) {
+            cap = cap ? cap * 2 : 64;
+            Cache_file * grown = realloc(found, cap * sizeof(Cache_file));
+            if (!grown) break;
+            found = grown;
+        }
+        found[count].key = key;
+        found[count].size = st.st_size;
+        found[count].used = st.st_ctim;
+        count++;
+    }
+    closedir(dir);
+
+    qsort(found, count, sizeof(Cache_file), by_used);
+    for (size_t i = 0; i < count; i++) {
+        cache_add(cache, found[i].key, found[i].size);
+    }
+    free(found);
+    cache_trim(cache);
+}
+
+void cache_touch(Output_cache * cache, Cache_entry * entry) {
+    // move an entry to the head of the lru list, cache locked
+    cache_unlink_entry(cache, entry);
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head) cache->head->prev = entry;
+    else cache->tail = entry;
+    cache->head = entry;
+}
+
+int cache_lookup(Output_cache * cache, Job * job) {
+    // give a job the cached output of identical text. called by submit
+    // before the job is handed over, so the link is made without the
+    // global mutex and admission only has to finish the job
+    // returns 1 on a hit with the output linked to the job's jobN.wav
+    pthread_mutex_lock(&cache->lock);
+    Cache_entry * entry = cache->limit > 0 ? cache_find(cache, job->content_key) : NULL;
+    size_t size = 0;
+    if (entry) {
+        size = entry->size;
+        cache_touch(cache, entry);
+    }
+    else if (cache->limit > 0) {
+        cache->misses++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    if (!entry) return 0;
+
+    char path[64];
+    cache_path(path, job->content_key);
+    // a fifo at jobN.wav is a consumer waiting for the job to stream into
+    // it, so the job runs. any other jobN.wav left over is replaced
+    char out[JOB_NAME_MAX];
+    struct stat st;
+    if (lstat(job_output(job, out), &st) == 0 && S_ISFIFO(st.st_mode)) return 0;
+    unlink(out);
+    int linked = link(path, out) == 0;
+
+    pthread_mutex_lock(&cache->lock);
+    if (linked) {
+        cache->hits++;
+    }
+    else {
+        // the file went missing, forget it unless it was evicted meanwhile
+        entry = cache_find(cache, job->content_key);
+        if (entry) cache_drop(cache, entry);
+        cache->misses++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    if (!linked) return 0;
+    job->out_size = size;
+    job->cached = 1;
+    return 1;
+}
+
+void cache_store(Output_cache * cache, Job * job, size_t size) {
+    // keep a finished output of size bytes for later duplicates, called
+    // without the global mutex. the link is made with the cache unlocked
+    // and the entry added after, unless another job stored the same text
+    pthread_mutex_lock(&cache->lock);
+    int skip = cache->limit == 0 || size > cache->limit || cache_find(cache, job->content_key);
+    pthread_mutex_unlock(&cache->lock);
+    if (skip) return;
+
+    char path[64];
+    char out[JOB_NAME_MAX];
+    cache_path(path, job->content_key);
+    unlink(path);
+    if (link(job_output(job, out), path) < 0) return;
+    pthread_mutex_lock(&cache->lock);
+    int kept = cache_find(cache, job->content_key) || cache_add(cache, job->content_key, size) == 0;
+    pthread_mutex_unlock(&cache->lock);
+    if (!kept) {
+        unlink(path);
+        return;
+    }
+    cache_trim(cache);
+}
+
+void cache_free(Output_cache * cache) {
+    // the files stay for the next run
+    Cache_entry * curr = cache->head;
+    while (curr) {
+        Cache_entry * next = curr->next;
+        free(curr);
+        curr = next;
+    }
+    free(cache->table);
+}
+
+void wake_loop(Job_list * queue) {
+    // tell the command loop a wait can be answered
+    uint64_t one = 1;
+    if (write(queue->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        printf("jobsched: unable to wake the command loop: %s\n", strerror(errno));
+    }
+}
+
+void notify_waiters(Job_list * queue, Job * job, int state) {
+    // answer the waits on one job, must be called with the mutex held
+    if (!job->waiters) return;
+    for (Waiter * curr = job->waiters; curr; curr = curr->next) {
+        curr->state = state;
+    }
+    job->waiters = NULL;
+    wake_loop(queue);
+}
+
+void runq_init(Run_queue * rq, char mode, int predict) {
+    pthread_mutex_init(&rq->lock, NULL);
+    heap_init(&rq->ready, HEAP_READY, ready_order(mode, predict));
+    heap_init(&rq->arrival, HEAP_ARRIVAL, by_arrival);
+    // a job is in ready or heavy, never both, so they share a slot
+    heap_init(&rq->heavy, HEAP_READY, ready_order(mode, predict));
+    rq->mode = mode;
+    rq->dispatched = 0;
+    rq->heavy_cap = 0;
+    rq->heavy_running = 0;
+}
+
+int runq_push(Run_queue * rq, Job * job) {
+    // queue a waiting job, the caller holds whatever lock protects rq
+    job->dispatch_stamp = rq->dispatched;
+    Job_heap * ready = job->heavy ? &rq->heavy : &rq->ready;
+    if (heap_push(ready, job) < 0) return -1;
+    if (heap_push(&rq->arrival, job) < 0) {
+        heap_remove(ready, job);
+        return -1;
+    }
+    return 0;
+}
+
+void runq_remove(Run_queue * rq, Job * job) {
+    heap_remove(job->heavy ? &rq->heavy : &rq->ready, job);
+    heap_remove(&rq->arrival, job);
+}
+
+Job * ready_top(Run_queue * rq) {
+    // the job the schedule ranks first among those that may start now:
+    // heavy jobs only while fewer than heavy_cap of them are running
+    Job * pick = rq->ready.len > 0 ? rq->ready.items[0] : NULL;
+    if (rq->heavy.len > 0 && rq->heavy_running < rq->heavy_cap) {
+        Job * heavy = rq->heavy.items[0];
+        if (!pick || rq->heavy.before(heavy, pick)) pick = heavy;
+    }
+    return pick;
+}
+
+size_t runnable_jobs(Job_list * queue) {
+    // waiting jobs a worker could start now, must hold the mutex
+    // steal workers take jobs off the count under their run queue locks
+    size_t waiting = __atomic_load_n(&queue->waiting, __ATOMIC_SEQ_CST);
+    Run_queue * rq = &queue->shared;
+    if (rq->heavy_running >= rq->heavy_cap && rq->heavy.len <= waiting) {
+        waiting -= rq->heavy.len;
+    }
+    return waiting;
+}
+
+double rss_predict(Job_list * queue, Job * job) {
+    // peak RSS in KB from the fitted line, 0 while nothing has been learned
+    if (queue->rss_n == 0) return 0;
+    double mean_x = queue->rss_sx / queue->rss_n;
+    double mean_y = queue->rss_sy / queue->rss_n;
+    double var = queue->rss_sxx / queue->rss_n - mean_x * mean_x;
+    // one input size so far says nothing about the slope
+    if (queue->rss_n < 2 || var <= 0) return mean_y;
+    double slope = (queue->rss_sxy / queue->rss_n - mean_x * mean_y) / var;
+    return mean_y + slope * ((double) job->in_size - mean_x);
+}
+
+void rss_learn(Job_list * queue, Job * job) {
+    // must hold the mutex, only a piper of its own says what a job needs
+    if (!job->usage.own || job->usage.max_rss_kb == 0) return;
+    double x = job->in_size;
+    double y = job->usage.max_rss_kb;
+    queue->rss_n++;
+    queue->rss_sx += x;
+    queue->rss_sy += y;
+    queue->rss_sxx += x * x;
+    queue->rss_sxy += x * y;
+}
+
+void set_memcap(Job_list * queue, int jobs, size_t kb) {
+    // cap the memory heavy jobs running at once, 0 jobs turns it off
+    // the jobs already waiting are sorted again into ready and heavy
+    pthread_mutex_lock(&mutex);
+    ingress_drain(queue);
+    Run_queue * rq = &queue->shared;
+    rq->heavy_cap = jobs;
+    queue->heavy_kb = kb;
+    for (size_t i = 0; i < rq->arrival.len; i++) {
+        Job * job = rq->arrival.items[i];
+        char heavy = jobs > 0 && rss_predict(queue, job) >= kb;
+        if (heavy == job->heavy) continue;
+        heap_remove(job->heavy ? &rq->heavy : &rq->ready, job);
+        job->heavy = heavy;
+        if (heap_push(heavy ? &rq->heavy : &rq->ready, job) < 0) {
+            // with no room in the other heap it stays where it was
+            job->heavy = !heavy;
+            heap_push(job->heavy ? &rq->heavy : &rq->ready, job);
+        }
+    }
+    // held jobs may be free to start now
+    pthread_cond_broadcast(&work_cond);
+    pthread_mutex_unlock(&mutex);
+}
+
+void heavy_done(Job_list * queue, Job * job) {
+    // give back a finished heavy job's place, must hold the mutex
+    if (!job->heavy) return;
+    job->heavy = 0;
+    queue->shared.heavy_running--;
+    if (queue->shared.heavy.len > 0) pthread_cond_signal(&work_cond);
+}
+
+void usage_from_rusage(Usage * usage, struct rusage * ru) {
+    // what wait4() reported for a piper that ran one job
+    usage->cpu_ns = (ru->ru_utime.tv_sec + ru->ru_stime.tv_sec) * 1000000000ull
+        + (ru->ru_utime.tv_usec + ru->ru_stime.tv_usec) * 1000ull;
+    // ru_maxrss is left out: posix_spawn starts the child's mark at our
+    // own resident size, so the peak is sampled by peak_watch() instead
+    usage->in_blocks = ru->ru_inblock;
+    usage->out_blocks = ru->ru_oublock;
+    usage->own = 1;
+}
+
+int proc_usage(pid_t pid, Usage * usage) {
+    // what a live piper has used so far, from /proc. cpu is in clock ticks
+    // and i/o in bytes there, converted to match wait4()
+    char path[64];
+    char line[512];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int) pid);
+    FILE * file = fopen(path, "r");
+    if (!file) return -1;
+    unsigned long long utime = 0, stime = 0;
+    int found = 0;
+    if (fgets(line, sizeof(line), file)) {
+        // the command name may hold spaces, the fields after it do not
+        char * p = strrchr(line, ')');
+        found = p && sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu"
+                , &utime, &stime) == 2;
+    }
+    fclose(file);
+    if (!found) return -1;
+    long ticks = sysconf(_SC_CLK_TCK);
+    usage->cpu_ns = (utime + stime) * (1000000000ull / (ticks > 0 ? ticks : 100));
+
+    usage->max_rss_kb = proc_peak_kb(pid);
+
+    usage->in_blocks = usage->out_blocks = 0;
+    snprintf(path, sizeof(path), "/proc/%d/io", (int) pid);
+    file = fopen(path, "r");
+    while (file && fgets(line, sizeof(line), file)) {
+        unsigned long long bytes;
+        if (sscanf(line, "read_bytes: %llu", &bytes) == 1) usage->in_blocks = bytes / 512;
+        if (sscanf(line, "write_bytes: %llu", &bytes) == 1) usage->out_blocks = bytes / 512;
+    }
+    if (file) fclose(file);
+    usage->own = 0;
+    return 0;
+}
+
+uint32_t proc_peak_kb(pid_t pid) {
+    // a live process's own peak resident memory in kilobytes, 0 once it
+    // has exited and its memory is gone
+    char path[64];
+    char line[512];
+    uint32_t peak = 0;
+    snprintf(path, sizeof(path), "/proc/%d/status", (int) pid);
+    FILE * file = fopen(path, "r");
+    while (file && fgets(line, sizeof(line), file)) {
+        unsigned long kb;
+        if (sscanf(line, "VmHWM: %lu", &kb) == 1) peak = kb;
+    }
+    if (file) fclose(file);
+    return peak;
+}
+
+void peak_watch(pid_t pid, uint32_t * peak_kb) {
+    // raise *peak_kb to the piper's peak memory until it exits or stops
+    // the high water mark only grows, so the last read before the exit
+    // misses at most PEAK_SAMPLE_MS of growth
+    int fd = syscall(SYS_pidfd_open, pid, 0);
+    if (fd < 0) return;
+    while (1) {
+        uint32_t kb = proc_peak_kb(pid);
+        if (kb > *peak_kb) *peak_kb = kb;
+        struct pollfd ready = {fd, POLLIN, 0};
+        int n = poll(&ready, 1, PEAK_SAMPLE_MS);
+        if (n < 0 && errno == EINTR) continue;
+        if (n != 0) break;
+        // a piper paused by preempt_check() does not make the pidfd readable
+        siginfo_t info;
+        info.si_pid = 0;
+        if (waitid(P_PID, pid, &info, WSTOPPED | WNOHANG | WNOWAIT) == 0 && info.si_pid != 0) break;
+    }
+    close(fd);
+}
+
+void usage_add(Usage * total, Usage * part) {
+    // a split job used what its parts did together, its peak is the largest
+    total->own = total->cpu_ns == 0 && total->max_rss_kb == 0 ? part->own : total->own && part->own;
+    total->cpu_ns += part->cpu_ns;
+    if (part->max_rss_kb > total->max_rss_kb) total->max_rss_kb = part->max_rss_kb;
+    total->in_blocks += part->in_blocks;
+    total->out_blocks += part->out_blocks;
+}
+
+void set_schedule(Job_list * queue, char mode) {
+    // switch the scheduling algorithm, jobs that are already waiting are reordered
+    pthread_mutex_lock(&mutex);
+    queue->mode = mode;
+    queue->shared.mode = mode;
+    heap_rebuild(&queue->shared.ready, ready_order(mode, queue->predict));
+    heap_rebuild(&queue->shared.heavy, ready_order(mode, queue->predict));
+    for (int i = 0; i < queue->nrunq; i++) {
+        Run_queue * rq = &queue->runq[i];
+        pthread_mutex_lock(&rq->lock);
+        rq->mode = mode;
+        heap_rebuild(&rq->ready, ready_order(mode, queue->predict));
+        pthread_mutex_unlock(&rq->lock);
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+int policy_index(char mode) {
+    for (int i = 0; i < POLICIES; i++) {
+        if (policy_modes[i] == mode) return i;
+    }
+    return 0;
+}
+
+Job * peek_job(Run_queue * rq) {
+    // the job next_job() would return, the caller holds the lock protecting rq
+    // fcfs and sjf take the top of the ready heap. balanced takes the oldest
+    // waiting job instead once it has been passed over too many times
+    // a memory heavy job held back by the cap is skipped either way
+    Job * pick = ready_top(rq);
+    if (!pick) return NULL;
+    if (rq->mode == 'b') {
+        Job * oldest = rq->arrival.items[0];
+        if (rq->dispatched - oldest->dispatch_stamp >= BALANCED_THRESHOLD
+                && (!oldest->heavy || rq->heavy_running < rq->heavy_cap)) {
+            pick = oldest;
+        }
+    }
+    return pick;
+}
+
+Job * next_job(Job_list * queue, Run_queue * rq) {
+    // pops the next job to run, the caller holds the lock protecting rq
+    Job * pick = peek_job(rq);
+    if (!pick) return NULL;
+
+    runq_remove(rq, pick);
+    // it keeps its place against the cap until it finishes, paused or not
+    if (pick->heavy) rq->heavy_running++;
+
+    pick->passed_over = rq->dispatched - pick->dispatch_stamp;
+    pick->policy = rq->mode;
+    uint64_t vtime = __atomic_load_n(&queue->vtime, __ATOMIC_RELAXED);
+    while (pick->vstart > vtime && !__atomic_compare_exchange_n(&queue->vtime, &vtime
+                , pick->vstart, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    rq->dispatched++;
+    __atomic_sub_fetch(&queue->waiting, 1, __ATOMIC_SEQ_CST);
+    return pick;
+}
+
+int next_batch(Job_list * queue, Run_queue * rq, Job ** batch) {
+    // pops the next job plus, when batching is on for this policy, any
+    // following jobs that fit in the byte and count budget
+    // the jobs keep the order the policy would have run them in
+    // the caller holds the lock protecting rq, returns the number of jobs
+    int policy = policy_index(rq->mode);
+    size_t budget = __atomic_load_n(&queue->batch_bytes[policy], __ATOMIC_RELAXED);
+    int limit = __atomic_load_n(&queue->batch_jobs[policy], __ATOMIC_RELAXED);
+    if (limit > BATCH_MAX) limit = BATCH_MAX;
+
+    batch[0] = next_job(queue, rq);
+    if (!batch[0]) return 0;
+    int n = 1;
+    if (limit > 1 && batch[0]->in_size <= budget) {
+        budget -= batch[0]->in_size;
+        while (n < limit) {
+            Job * next = peek_job(rq);
+            if (!next || next->in_size > budget) break;
+            batch[n++] = next_job(queue, rq);
+            budget -= next->in_size;
+        }
+    }
+
+    // mark them running while rq is still locked, so delete() can tell a
+    // job that was just popped from one that is still waiting
+    for (int i = 0; i < n; i++) {
+        __atomic_store_n(&batch[i]->state, JOB_RUNNING, __ATOMIC_RELEASE);
+        // a split job is running from when its first part is taken
+        Job * parent = batch[i]->parent;
+        if (parent && parent->state == JOB_WAITING) {
+            parent->start_time = now_ns();
+            parent->policy = rq->mode;
+            __atomic_store_n(&parent->state, JOB_RUNNING, __ATOMIC_RELEASE);
+        }
+    }
+    return n;
+}
+
+int take_batch(Job_list * queue, Run_queue * rq, Job ** batch) {
+    // pop a batch from a per worker run queue, only rq's lock is taken
+    pthread_mutex_lock(&rq->lock);
+    int n = next_batch(queue, rq, batch);
+    pthread_mutex_unlock(&rq->lock);
+    return n;
+}
+
+void preempt_check(Job_list * queue) {
+    // shortest remaining time: when no worker is free for the shortest
+    // waiting job, stop the running job with the most predicted time left
+    // if it has PREEMPT_RATIO times longer to go. called with the mutex held
+    // after jobs are queued, the worker running the job parks it
+    if (!queue->preempt || (queue->mode != 's' && queue->mode != 'b') || queue->nrunq > 0) return;
+    if (queue->idle_workers > 0 || queue->live_workers < queue->max_workers) return;
+
+    // one stop per waiting job that could start at most
+    while ((size_t) queue->stopping < runnable_jobs(queue)) {
+        Job * top = ready_top(&queue->shared);
+        if (!top) return;
+        double shortest = top->predicted_run;
+        uint64_t now = now_ns();
+        Job * victim = NULL;
+        double most = 0;
+        for (int i = 0; i < queue->nrunning; i++) {
+            Job * job = queue->running[i];
+            if (job->stopping) continue;
+            double left = job->predicted_run - (now - job->start_time - job->paused_ns) / 1e9;
+            if (left > most) {
+                most = left;
+                victim = job;
+            }
+        }
+        if (!victim || most < shortest * PREEMPT_RATIO) return;
+        if (kill(victim->pid, SIGSTOP) < 0) return;
+        victim->stopping = 1;
+        queue->stopping++;
+    }
+}
+
+Job * resume_job(Job_list * queue) {
+    // the paused job to continue next, if it has less time left than the
+    // shortest waiting job would take. called with the mutex held
+    // the job is marked running and its piper continued
+    if (queue->paused.len == 0) return NULL;
+    Job * job = queue->paused.items[0];
+    Job * top = ready_top(&queue->shared);
+    if (top && (queue->mode == 's' || queue->mode == 'b') && top->predicted_run < job->remaining) {
+        return NULL;
+    }
+
+    heap_remove(&queue->paused, job);
+    job->paused_ns += now_ns() - job->paused_at;
+    job->paused_at = 0;
+    job->run_slot = queue->nrunning;
+    queue->running[queue->nrunning++] = job;
+    __atomic_store_n(&job->state, JOB_RUNNING, __ATOMIC_RELEASE);
+    kill(job->pid, SIGCONT);
+    return job;
+}
+
+int output_full(Job_list * queue) {
+    // whether finished outputs are at the budget, so workers hold off
+    // read without the mutex by steal workers
+    size_t budget = __atomic_load_n(&queue->output_budget, __ATOMIC_RELAXED);
+    return budget > 0 && __atomic_load_n(&queue->total_output_size, __ATOMIC_RELAXED) >= budget;
+}
+
+void evict_outputs(Job_list * queue) {
+    // remove finished outputs until they are under the budget, mutex held
+    // pinned jobs are not in the heap, so they are kept whatever the total
+    if (queue->evict == 's' || queue->output_budget == 0) return;
+    while (queue->total_output_size >= queue->output_budget && queue->outputs.len > 0) {
+        Job * job = queue->outputs.items[0];
+        // the file goes once the mutex is let go, ids are never reused
+        if (queue->nvictims == queue->victims_cap) {
+            size_t cap = queue->victims_cap ? 2 * queue->victims_cap : 16;
+            char (* victims)[JOB_NAME_MAX] = realloc(queue->victims, cap * sizeof(*victims));
+            if (!victims) {
+                printf("jobsched-evict: out of memory, keeping job %d\n", job->jobid);
+                return;
+            }
+            queue->victims = victims;
+            queue->victims_cap = cap;
+        }
+        heap_remove(&queue->outputs, job);
+        job_output(job, queue->victims[queue->nvictims]);
+        __atomic_store_n(&queue->nvictims, queue->nvictims + 1, __ATOMIC_RELAXED);
+        job->evicted = 1;
+        __atomic_sub_fetch(&queue->total_output_size, job->out_size, __ATOMIC_RELAXED);
+        queue->evictions++;
+        queue->evicted_bytes += job->out_size;
+    }
+}
+
+void evict_flush(Job_list * queue) {
+    // remove the outputs evict_outputs() picked, called without the mutex
+    // read without the mutex, a victim missed here goes with the next flush
+    if (!__atomic_load_n(&queue->nvictims, __ATOMIC_RELAXED)) return;
+    pthread_mutex_lock(&mutex);
+    char (* victims)[JOB_NAME_MAX] = queue->victims;
+    size_t n = queue->nvictims;
+    queue->victims = NULL;
+    queue->victims_cap = 0;
+    __atomic_store_n(&queue->nvictims, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&mutex);
+
+    for (size_t i = 0; i < n; i++) {
+        if (unlink(victims[i]) < 0 && errno != ENOENT) {
+            printf("jobsched-evict: unable to remove %s: %s\n", victims[i], strerror(errno));
+        }
+    }
+    free(victims);
+}
+
+void output_kept(Job_list * queue, Job * job) {
+    // a job has just finished and its output counts against the budget,
+    // mutex held. it becomes evictable, and older outputs make room for it
+    job->used_at = job->out_time;
+    // a fifo is never evicted, that would unlink the consumer's fifo
+    if (job->out_size > 0 && !job->pinned && !job->fifo) heap_push(&queue->outputs, job);
+    evict_outputs(queue);
+}
+
+void output_used(Job_list * queue, Job * job) {
+    // a finished job was reported, under lru its output goes to the back
+    job->used_at = now_ns();
+    if (job->heap_pos[HEAP_DONE] != HEAP_NONE) {
+        heap_remove(&queue->outputs, job);
+        heap_push(&queue->outputs, job);
+    }
+}
+
+int set_pinned(Job_list * queue, int jobid, int pin) {
+    // keep a job's output out of eviction, or let it be evicted again
+    pthread_mutex_lock(&mutex);
+    ingress_drain(queue);
+    Job * job = index_find(queue, jobid);
+    if (!job) {
+        fprintf(reply, "jobsched-pin: unable to find job %d\n", jobid);
+        pthread_mutex_unlock(&mutex);
+        return -1;
+    }
+    if (job->evicted) {
+        fprintf(reply, "jobsched-pin: the output of job %d was already evicted\n", jobid);
+        pthread_mutex_unlock(&mutex);
+        return -1;
+    }
+    if (job->pinned != pin) {
+        job->pinned = pin;
+        // a job that is not done yet holds its arrival heap place in the slot
+        if (pin) {
+            queue->pinned++;
+            if (job->state == JOB_DONE) heap_remove(&queue->outputs, job);
+        }
+        else {
+            queue->pinned--;
+            // an unpinned output counts as just used
+            if (job->state == JOB_DONE && job->out_size > 0 && !job->fifo) {
+                job->used_at = now_ns();
+                heap_push(&queue->outputs, job);
+                evict_outputs(queue);
+            }
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+    return 0;
+}
+
+int delete(Job_list * queue, int jobid) {
+    // deletes the job with the specified jobid
+    // acquire lock
+    Job * curr;
+    pthread_mutex_lock(&mutex);
+    ingress_drain(queue);
+
+    // find the job
+    curr = index_find(queue, jobid);
+
+    // handle missing job
+    if (!curr) {
+        fprintf(reply, "jobsched-delete: unable to find job with id: %d. No job was deleted.\n", jobid);
+        pthread_mutex_unlock(&mutex);
+        return -1;
+    }
+
+    // a waiting job in a per worker run queue can be popped at any moment,
+    // so hold that queue's lock while checking and removing it
+    Run_queue * rq = NULL;
+    if (curr->runq >= 0) {
+        rq = &queue->runq[curr->runq];
+        pthread_mutex_lock(&rq->lock);
+    }
+    int state = __atomic_load_n(&curr->state, __ATOMIC_ACQUIRE);
+    if (state == JOB_RUNNING || state == JOB_PAUSED) {
+        fprintf(reply, "jobsched-delete: Job %d is currently %s, and cannot be deleted!!\n", jobid
+                , state == JOB_RUNNING ? "running" : "paused");
+        if (rq) pthread_mutex_unlock(&rq->lock);
+        pthread_mutex_unlock(&mutex);
+        return -1;
+    }
+
+    // anyone waiting on this job will never see it finish
+    notify_waiters(queue, curr, -1);
+
+    // if the job is either waiting
+    if (curr->state == JOB_WAITING && curr->parts) {
+        // none of its parts has started, they are all in the shared queue
+        for (int i = 0; i < curr->nparts; i++) {
+            runq_remove(&queue->shared, curr->parts[i]);
+        }
+        __atomic_sub_fetch(&queue->waiting, curr->nparts, __ATOMIC_SEQ_CST);
+        parts_free(curr->parts, curr->nparts);
+    }
+    else if (curr->state == JOB_WAITING) {
+        runq_remove(rq ? rq : &queue->shared, curr);
+        __atomic_sub_fetch(&queue->waiting, 1, __ATOMIC_SEQ_CST);
+    }
+    // or done
+    else if (curr->state == JOB_DONE) {
+        queue->done--;
+        totals_done(queue, curr, -1);
+        heap_remove(&queue->outputs, curr);
+        // an evicted output is gone already
+        if (!curr->evicted) {
+            // freeing output may let stalled workers run again
+            int full = output_full(queue);
+            if (!curr->fifo) __atomic_sub_fetch(&queue->total_output_size, curr->out_size, __ATOMIC_RELAXED);
+            if (full && !output_full(queue)) pthread_cond_broadcast(&work_cond);
+
+            // remove the output file
+            char out[JOB_NAME_MAX];
+            if (remove(job_output(curr, out)) < 0) {
+                fprintf(reply, "jobsched-delete: Error removing file %s: %s\n", out, strerror(errno));
+                fprintf(reply, "jobsched-delete: still removing job %d\n", jobid);
+            }
+        }
+    }
+    if (curr->pinned) queue->pinned--;
+    if (rq) pthread_mutex_unlock(&rq->lock);
+
+    // changes that are made every time
+    index_remove(queue, jobid);
+    queue->count--;
+    queue->totals.in_size -= curr->in_size;
+    // remove from the list 
+    if (curr == queue->head) {
+        queue->head = curr->next;
+    }
+    else if (queue->tail == curr) {
+        queue->tail = curr->prev;
+    }
+    if (curr->next) {
+        curr->next->prev = curr->prev;
+    }
+    if (curr->prev) {
+        curr->prev->next = curr->next;
+    }
+
+    // deleting the last unfinished job answers waitall
+    if (queue->all_waiters > 0 && queue->done == queue->count) {
+        wake_loop(queue);
+    }
+
+    // remove node
+    job_release(curr);
+    fprintf(reply, "jobsched-delete: Job %d has been removed\n", jobid);
+    pthread_mutex_unlock(&mutex);
+    
+    return 0;
+}
+
+void add_pending(Session * session, Waiter * waiter) {
+    // kept in the order asked, so answers come out in that order
+    waiter->next_pending = NULL;
+    if (session->pending_tail) session->pending_tail->next_pending = waiter;
+    else session->pending = waiter;
+    session->pending_tail = waiter;
+}
+
+void wait_all(Job_list * queue, Session * session) {
+    // report when all the jobs are done, now if they already are
+    pthread_mutex_lock(&mutex);
+    ingress_drain(queue);
+    if (queue->done == queue->count) {
+        fprintf(reply, "All Jobs Are Done!!\n");
+        pthread_mutex_unlock(&mutex);
+        return;
+    }
+    Waiter * self = malloc(sizeof(Waiter));
+    if (!self) {
+        fprintf(reply, "jobsched-waitall: unable to allocate a wait\n");
+        pthread_mutex_unlock(&mutex);
+        return;
+    }
+    self->jobid = 0;
+    self->state = 0;
+    self->next = NULL;
+    add_pending(session, self);
+    queue->all_waiters++;
+    pthread_mutex_unlock(&mutex);
+}
+
+void report_wait(Job_list * queue, int jobid, Job * curr) {
+    // the final status and times of a finished job, mutex held
+    fprintf(reply, "Job %d was a ", jobid);
+    if (curr->out_size == 0) {
+        fprintf(reply, "Failure!\n");
+    }
+    else {
+        fprintf(reply, "Success!\n");
+        time_t in = (curr->in_time + queue->wall_offset) / 1000000000ull;
+        time_t start = (curr->start_time + queue->wall_offset) / 1000000000ull;
+        time_t out = (curr->out_time + queue->wall_offset) / 1000000000ull;
+        fprintf(reply, "Job %d was submitted at: %s", jobid, ctime(&in));
+        fprintf(reply, "Job %d started running at %s", jobid, ctime(&start));
+        fprintf(reply, "Job %d finished at %s", jobid, ctime(&out));
+        fprintf(reply, "Job %d response time %.6fs, turnaround time %.6fs\n", jobid
+                , (curr->start_time - curr->in_time) / 1e9, (curr->out_time - curr->in_time) / 1e9);
+        fprintf(reply, "Job %d time to first audio %.6fs%s\n", jobid
+                , (curr->first_audio_time - curr->in_time) / 1e9, curr->streamed ? ", streamed" : "");
+        if (curr->preemptions > 0) {
+            fprintf(reply, "Job %d was preempted %d times and paused for %.6fs\n", jobid
+                    , curr->preemptions, curr->paused_ns / 1e9);
+        }
+        if (curr->evicted) {
+            fprintf(reply, "Job %d output was evicted to stay under the output budget\n", jobid);
+        }
+        output_used(queue, curr);
+    }
+}
+
+void waitfor(Job_list * queue, Session * session, int jobid) {
+    // report when a specific job is done, now if it already is
+    Job * curr;
+
+    pthread_mutex_lock(&mutex);
+    ingress_drain(queue);
+    // find the address of the job to check
+    curr = index_find(queue, jobid);
+    if (!curr) {
+        fprintf(reply, "jobsched-wait: unable to find job %d\n", jobid);
+        pthread_mutex_unlock(&mutex);
+        return;
+    }
+
+    if (curr->state == JOB_DONE) {
+        report_wait(queue, jobid, curr);
+        pthread_mutex_unlock(&mutex);
+        return;
+    }
+
+    // answered by answer_waits() once the job finishes
+    Waiter * self = malloc(sizeof(Waiter));
+    if (!self) {
+        fprintf(reply, "jobsched-wait: unable to allocate a wait\n");
+        pthread_mutex_unlock(&mutex);
+        return;
+    }
+    self->jobid = jobid;
+    self->state = 0;
+    self->next = curr->waiters;
+    curr->waiters = self;
+    add_pending(session, self);
+    pthread_mutex_unlock(&mutex);
+}
+
+void answer_waits(Job_list * queue, Session * session) {
+    // report the waits of a session that have been answered
+    reply = session->out;
+    pthread_mutex_lock(&mutex);
+    // a waitall is only answered once the jobs still in the ingress are done
+    ingress_drain(queue);
+    Waiter ** link = &session->pending;
+    session->pending_tail = NULL;
+    while (*link) {
+        Waiter * curr = *link;
+        if (curr->jobid == 0 && queue->done == queue->count) {
+            queue->all_waiters--;
+            fprintf(reply, "All Jobs Are Done!!\n");
+        }
+        else if (curr->jobid != 0 && curr->state != 0) {
+            // a job can also be deleted between finishing and this report
+            Job * job = curr->state > 0 ? index_find(queue, curr->jobid) : NULL;
+            if (job) {
+                report_wait(queue, curr->jobid, job);
+            }
+            else {
+                fprintf(reply, "jobsched-wait: job %d was deleted before it finished\n", curr->jobid);
+            }
+        }
+        else {
+            // still waiting
+            session->pending_tail = curr;
+            link = &curr->next_pending;
+            continue;
+        }
+        if (session->client) fprintf(reply, ".\n");
+        *link = curr->next_pending;
+        free(curr);
+    }
+    pthread_mutex_unlock(&mutex);
+    reply = stdout;
+}
+
+void session_init(Session * session, int fd, int client) {
+    session->fd = fd;
+    session->client = client;
+    session->pollable = 1;
+    session->in = malloc(SESSION_BUFFER);
+    session->in_start = 0;
+    session->in_len = 0;
+    session->input_open = 1;
+    session->quit = 0;
+    session->events = 0;
+    session->out_buf = NULL;
+    session->out_size = 0;
+    session->out_sent = 0;
+    // a client's output is buffered and sent as the socket takes it,
+    // so one slow reader does not hold up the loop
+    session->out = client ? open_memstream(&session->out_buf, &session->out_size) : stdout;
+    session->pending = NULL;
+    session->pending_tail = NULL;
+    session->block = 0;
+    for (int i = 0; i < 3; i++) session->set_pos[i] = SET_NONE;
+}
+
+void session_read(Session * session) {
+    // read what is available, the buffer always has room after session_run
+    if (session->in_start > 0) {
+        memmove(session->in, session->in + session->in_start, session->in_len - session->in_start);
+        session->in_len -= session->in_start;
+        session->in_start = 0;
+    }
+    ssize_t n = read(session->fd, session->in + session->in_len, SESSION_BUFFER - session->in_len);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+    if (n <= 0) {
+        session->input_open = 0;
+        return;
+    }
+    session->in_len += n;
+}
+
+int session_run(Job_list * queue, Session * session) {
+    // run every complete buffered line, returns 1 if one of them was quit
+    // a client sees the end of each command's output as a line with one dot
+    char line[MAX_INPUT_LEN];
+    reply = session->out;
+    while (!(session->block && session->pending)) {
+        char * start = session->in + session->in_start;
+        size_t avail = session->in_len - session->in_start;
+        if (avail == 0) break;
+        char * end = memchr(start, '\n', avail);
+        size_t len;
+        if (end) {
+            len = end - start + 1;
+        }
+        // an over long line is split the way fgets would split it,
+        // and the last line may be missing its newline
+        else if (avail >= (size_t) MAX_INPUT_LEN - 1 || !session->input_open) {
+            len = avail;
+        }
+        else {
+            break;
+        }
+        size_t copy = len < (size_t) MAX_INPUT_LEN - 1 ? len : (size_t) MAX_INPUT_LEN - 1;
+        memcpy(line, start, copy);
+        line[copy] = 0;
+        session->in_start += copy;
+        int quit = run_command(queue, session, line);
+        // whatever the command evicted, or cached jobs it admitted pushed out
+        evict_flush(queue);
+        if (session->client) fprintf(reply, ".\n");
+        if (quit) {
+            reply = stdout;
+            return 1;
+        }
+    }
+    reply = stdout;
+    return 0;
+}
+
+int session_flush(Session * session) {
+    // send what the client will take without blocking, -1 if it is gone
+    fflush(session->out);
+    if (!session->client) return 0;
+    while (session->out_sent < session->out_size) {
+        ssize_t n = write(session->fd, session->out_buf + session->out_sent
+                , session->out_size - session->out_sent);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN) return 0;
+        if (n <= 0) return -1;
+        session->out_sent += n;
+    }
+    // all sent, start the buffer over
+    fseeko(session->out, 0, SEEK_SET);
+    fflush(session->out);
+    session->out_sent = 0;
+    return 0;
+}
+
+void session_free(Job_list * queue, Session * session) {
+    // forget a session's unanswered waits, then its buffers
+    pthread_mutex_lock(&mutex);
+    while (session->pending) {
+        Waiter * curr = session->pending;
+        session->pending = curr->next_pending;
+        if (curr->jobid == 0) {
+            queue->all_waiters--;
+        }
+        else if (curr->state == 0) {
+            // still on its job's list
+            Job * job = index_find(queue, curr->jobid);
+            Waiter ** link = job ? &job->waiters : NULL;
+            while (link && *link && *link != curr) link = &(*link)->next;
+            if (link && *link) *link = curr->next;
+        }
+        free(curr);
+    }
+    pthread_mutex_unlock(&mutex);
+    if (session->client) {
+        fclose(session->out);
+        free(session->out_buf);
+        close(session->fd);
+    }
+    free(session->in);
+    free(session);
+}
+
+int set_add(Session_set * set, Session * session) {
+    // put a session on a list, O(1) and nothing if it is already there
+    if (session->set_pos[set->slot] != SET_NONE) return 0;
+    if (set->len == set->cap) {
+        size_t cap = set->cap ? set->cap * 2 : 16;
+        Session ** items = realloc(set->items, cap * sizeof(Session *));
+        if (!items) {
+            printf("jobsched: unable to grow a session list: %s\n", strerror(errno));
+            return -1;
+        }
+        set->items = items;
+        set->cap = cap;
+    }
+    session->set_pos[set->slot] = set->len;
+    set->items[set->len++] = session;
+    return 0;
+}
+
+void set_remove(Session_set * set, Session * session) {
+    // take a session off a list, the last one fills its place
+    size_t i = session->set_pos[set->slot];
+    if (i == SET_NONE) return;
+    session->set_pos[set->slot] = SET_NONE;
+    Session * last = set->items[--set->len];
+    if (i == set->len) return;
+    set->items[i] = last;
+    last->set_pos[set->slot] = i;
+}
+
+int session_update(Job_list * queue, Session * session, int loop_fd) {
+    // run what a session has buffered, send its output and choose what to
+    // poll it for next. returns 1 once the session is finished
+    if (!session->quit && session_run(queue, session)) session->quit = 1;
+    if (session_flush(session) < 0) return 1;
+    size_t unsent = session->out_size - session->out_sent;
+    if ((session->quit || (!session->input_open && !session->pending)) && unsent == 0) return 1;
+
+    uint32_t events = 0;
+    // stop reading a client that is not reading its output
+    if (session->input_open && !session->quit && !(session->block && session->pending)
+            && unsent < SESSION_BACKLOG) {
+        events |= EPOLLIN;
+    }
+    if (unsent > 0) events |= EPOLLOUT;
+    if (session->pollable && events != session->events) {
+        struct epoll_event event;
+        event.events = events;
+        event.data.fd = session->fd;
+        epoll_ctl(loop_fd, EPOLL_CTL_MOD, session->fd, &event);
+    }
+    session->events = events;
+    return 0;
+}
+
+int add_session(Session *** sessions, size_t * cap, int fd, int client) {
+    // sessions are indexed by file descriptor
+    if ((size_t) fd >= *cap) {
+        size_t grown_cap = *cap ? *cap : 64;
+        while (grown_cap <= (size_t) fd) grown_cap *= 2;
+        Session ** grown = realloc(*sessions, grown_cap * sizeof(Session *));
+        if (!grown) return -1;
+        memset(grown + *cap, 0, (grown_cap - *cap) * sizeof(Session *));
+        *sessions = grown;
+        *cap = grown_cap;
+    }
+    Session * session = malloc(sizeof(Session));
+    if (!session) return -1;
+    session_init(session, fd, client);
+    if (!session->out) {
+        free(session->in);
+        free(session);
+        return -1;
+    }
+    (*sessions)[fd] = session;
+    return 0;
+}
+
+void command_loop(Job_list * queue, int listen_fd) {
+    // sleep in epoll on the eventfd workers write when a wait can be
+    // answered, and on stdin or on the daemon socket and its clients
+    // waits are answered from here, so they never stop commands being read
+    int loop_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop_fd < 0) {
+        printf("jobsched: unable to set up the command loop: %s\n", strerror(errno));
+        return;
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = queue->wake_fd;
+    epoll_ctl(loop_fd, EPOLL_CTL_ADD, queue->wake_fd, &event);
+
+    // the daemon stops cleanly on SIGINT and SIGTERM, they are blocked in
+    // every thread and read here instead
+    int signal_fd = -1;
+    if (listen_fd >= 0) {
+        sigset_t stop;
+        sigemptyset(&stop);
+        sigaddset(&stop, SIGINT);
+        sigaddset(&stop, SIGTERM);
+        signal_fd = signalfd(-1, &stop, SFD_NONBLOCK | SFD_CLOEXEC);
+        event.data.fd = signal_fd;
+        epoll_ctl(loop_fd, EPOLL_CTL_ADD, signal_fd, &event);
+        event.data.fd = listen_fd;
+        epoll_ctl(loop_fd, EPOLL_CTL_ADD, listen_fd, &event);
+    }
+
+    Session ** sessions = NULL;
+    size_t cap = 0;
+    Session_set dirty = {NULL, 0, 0, SET_DIRTY};
+    Session_set waiting = {NULL, 0, 0, SET_WAITING};
+    Session_set unpolled = {NULL, 0, 0, SET_UNPOLLED};
+    if (listen_fd < 0 && add_session(&sessions, &cap, STDIN_FILENO, 0) == 0) {
+        Session * in = sessions[STDIN_FILENO];
+        event.data.fd = STDIN_FILENO;
+        // a regular file cannot be polled, it is always readable
+        in->pollable = epoll_ctl(loop_fd, EPOLL_CTL_ADD, STDIN_FILENO, &event) == 0;
+        in->events = EPOLLIN;
+        if (!in->pollable) set_add(&unpolled, in);
+        set_add(&dirty, in);
+    }
+
+    int running = 1;
+    while (running) {
+        // bring the sessions something happened to up to date
+        while (dirty.len > 0) {
+            Session * session = dirty.items[dirty.len - 1];
+            set_remove(&dirty, session);
+            if (session_update(queue, session, loop_fd)) {
+                // stdin finishing ends jobsched, a client finishing closes it
+                if (!session->client) running = 0;
+                set_remove(&waiting, session);
+                set_remove(&unpolled, session);
+                sessions[session->fd] = NULL;
+                session_free(queue, session);
+                continue;
+            }
+            if (session->pending) set_add(&waiting, session);
+            else set_remove(&waiting, session);
+        }
+        if (!running) break;
+        // a session that cannot be polled is read on every pass
+        int timeout = -1;
+        for (size_t i = 0; i < unpolled.len; i++) {
+            if (unpolled.items[i]->events & EPOLLIN) timeout = 0;
+        }
+
+        struct epoll_event ready[MAX_EVENTS];
+        int n = epoll_wait(loop_fd, ready, MAX_EVENTS, timeout);
+        if (n < 0 && errno != EINTR) {
+            printf("jobsched: command loop failed: %s\n", strerror(errno));
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            int fd = ready[i].data.fd;
+            if (fd == queue->wake_fd) {
+                uint64_t wakes;
+                while (read(queue->wake_fd, &wakes, sizeof(wakes)) > 0);
+                for (size_t s = 0; s < waiting.len; s++) {
+                    answer_waits(queue, waiting.items[s]);
+                    set_add(&dirty, waiting.items[s]);
+                }
+            }
+            else if (fd == signal_fd) {
+                running = 0;
+            }
+            else if (fd == listen_fd) {
+                int client;
+                while ((client = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                    if (add_session(&sessions, &cap, client, 1) < 0) {
+                        printf("jobsched-daemon: unable to take another client\n");
+                        close(client);
+                        continue;
+                    }
+                    event.data.fd = client;
+                    epoll_ctl(loop_fd, EPOLL_CTL_ADD, client, &event);
+                    sessions[client]->events = EPOLLIN;
+                }
+            }
+            else if ((size_t) fd < cap && sessions[fd]) {
+                if (ready[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) session_read(sessions[fd]);
+                // readable or writable, either way it has something to do
+                set_add(&dirty, sessions[fd]);
+            }
+        }
+        for (size_t i = 0; i < unpolled.len; i++) {
+            Session * session = unpolled.items[i];
+            if (!(session->events & EPOLLIN)) continue;
+            session_read(session);
+            set_add(&dirty, session);
+        }
+    }
+
+    for (size_t fd = 0; fd < cap; fd++) {
+        if (sessions[fd]) session_free(queue, sessions[fd]);
+    }
+    free(sessions);
+    free(dirty.items);
+    free(waiting.items);
+    free(unpolled.items);
+    if (signal_fd >= 0) close(signal_fd);
+    close(loop_fd);
+}
+
+int daemon_socket(char * path, struct stat * made) {
+    // listen on a unix socket, replacing a stale one from an earlier run
+    // made is set to the socket's identity, so exit removes only this one
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("jobsched-daemon: socket path %s is too long\n", path);
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        printf("jobsched-daemon: unable to create socket: %s\n", strerror(errno));
+        return -1;
+    }
+    // anything but a socket at the path is someone's file, it is kept
+    struct stat st;
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            printf("jobsched-daemon: %s exists and is not a socket\n", path);
+            close(fd);
+            return -1;
+        }
+        unlink(path);
+    }
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0
+            || lstat(path, made) < 0) {
+        printf("jobsched-daemon: unable to listen on %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int process(Job_list * queue, Job * work) {
+    // do the actual work 
+    // can only read job values without mutex, not list pointers
+    // running status prevents other threads from changing things
+    // returns 1 if the job was preempted, its piper is then stopped
+
+    // posix_spawn starts the child without copying our page tables, so the
+    // launch cost does not grow with the size of the queue
+    // the child gets the input file on stdin and /dev/null on stdout/stderr
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    char in[JOB_NAME_MAX], out[JOB_NAME_MAX];
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, job_input(work, in), O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+
+    char * args[] = {"piper", "-f", job_output(work, out), "-m", PIPER_MODEL, NULL};
+    pid_t new_pid;
+    int err = posix_spawn(&new_pid, "piper/piper", &actions, NULL, args, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (err != 0) {
+        printf("jobsched-process: unable to start piper for job %d: %s\n", work->jobid, strerror(err));
+        return -1;
+    }
+
+    // from here until it is reaped the child may be stopped for a shorter job
+    pthread_mutex_lock(&mutex);
+    work->pid = new_pid;
+    work->run_slot = queue->nrunning;
+    queue->running[queue->nrunning++] = work;
+    pthread_mutex_unlock(&mutex);
+    return piper_wait(queue, work);
+}
+
+int piper_wait(Job_list * queue, Job * work) {
+    // wait for a job's piper to exit or be stopped by preempt_check()
+    // returns 0 when it exited, 1 when it was paused and -1 on failure
+    pid_t pid = work->pid;
+    siginfo_t info;
+    peak_watch(pid, &work->usage.max_rss_kb);
+    // look without reaping first: the job leaves Job_list->running before
+    // its pid can be reused, so a SIGSTOP never reaches another process
+    while (waitid(P_PID, pid, &info, WEXITED | WSTOPPED | WNOWAIT) < 0 && errno == EINTR);
+
+    pthread_mutex_lock(&mutex);
+    Job * last = queue->running[--queue->nrunning];
+    queue->running[work->run_slot] = last;
+    last->run_slot = work->run_slot;
+    work->run_slot = -1;
+    if (work->stopping) {
+        work->stopping = 0;
+        queue->stopping--;
+    }
+    pthread_mutex_unlock(&mutex);
+
+    int status;
+    struct rusage ru;
+    while (wait4(pid, &status, WUNTRACED, &ru) < 0 && errno == EINTR);
+
+    if (WIFSTOPPED(status)) {
+        // park it, a worker picks it up again through resume_job()
+        pthread_mutex_lock(&mutex);
+        uint64_t now = now_ns();
+        work->paused_at = now;
+        work->remaining = work->predicted_run - (now - work->start_time - work->paused_ns) / 1e9;
+        work->preemptions++;
+        queue->preemptions++;
+        __atomic_store_n(&work->state, JOB_PAUSED, __ATOMIC_RELEASE);
+        if (heap_push(&queue->paused, work) < 0) {
+            // with nowhere to park it, let it carry on
+            __atomic_store_n(&work->state, JOB_RUNNING, __ATOMIC_RELEASE);
+            work->paused_at = 0;
+            work->run_slot = queue->nrunning;
+            queue->running[queue->nrunning++] = work;
+            kill(pid, SIGCONT);
+            pthread_mutex_unlock(&mutex);
+            return piper_wait(queue, work);
+        }
+        pthread_cond_signal(&work_cond);
+        pthread_mutex_unlock(&mutex);
+        return 1;
+    }
+
+    usage_from_rusage(&work->usage, &ru);
+
+    // handle weird exits
+    // if exited normally
+    if (WIFEXITED(status)) {
+        return 0;
+    }
+    else {
+        printf("jobsched-process: process %d exited abnormally", pid);
+        if (WIFSIGNALED(status)) {
+            printf(" with signal %d", WTERMSIG(status));
+            if (WCOREDUMP(status)) {
+                printf(": core dumped.");
+            }
+        }
+        printf("\n");
+        return -1;
+    }
+}
+
+int process_stream(Job_list * queue, Job * work) {
+    // run piper with --output_raw and copy its samples into the output as
+    // they arrive, so a reader can start playing before piper is done
+    // jobN.wav gets a header with the sizes left open, patched at the end.
+    // if jobN.wav is a fifo a consumer made, the samples go straight to it
+    char in[JOB_NAME_MAX], path[JOB_NAME_MAX];
+    job_output(work, path);
+    struct stat st;
+    work->fifo = lstat(path, &st) == 0 && S_ISFIFO(st.st_mode);
+    int out;
+    if (work->fifo) {
+        // non-blocking so a fifo nobody has open fails instead of hanging
+        out = open(path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+        if (out >= 0) fcntl(out, F_SETFL, 0);
+        work->cacheable = 0;
+    }
+    else {
+        out = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+    if (out < 0) {
+        printf("jobsched-stream: unable to open %s for job %d: %s\n", path, work->jobid
+                , errno == ENXIO ? "no reader on the fifo" : strerror(errno));
+        return -1;
+    }
+
+    int samples[2];
+    if (pipe2(samples, O_CLOEXEC) < 0) {
+        printf("jobsched-stream: unable to create pipe: %s\n", strerror(errno));
+        close(out);
+        return -1;
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, job_input(work, in), O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, samples[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+    char * args[] = {"piper", "--output_raw", "-m", PIPER_MODEL, NULL};
+    pid_t pid;
+    int err = posix_spawn(&pid, "piper/piper", &actions, NULL, args, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(samples[1]);
+    if (err != 0) {
+        printf("jobsched-stream: unable to start piper for job %d: %s\n", work->jobid, strerror(err));
+        close(samples[0]);
+        close(out);
+        return -1;
+    }
+
+    // the largest sizes a header can hold stand for unknown until piper is done
+    unsigned char header[44];
+    unsigned char fmt[16];
+    pcm_format(fmt, queue->sample_rate);
+    wav_header(header, fmt, 0xffffffff - 36);
+    int failed = write_all(out, (char *) header, sizeof(header)) < 0;
+    uint32_t data = 0;
+    char buf[16384];
+    uint64_t sampled = 0;
+    while (!failed) {
+        // piper may be gone by the end of its output, so its peak is read
+        // along the way
+        uint64_t now = now_ns();
+        if (now - sampled >= PEAK_SAMPLE_MS * 1000000ull) {
+            uint32_t kb = proc_peak_kb(pid);
+            if (kb > work->usage.max_rss_kb) work->usage.max_rss_kb = kb;
+            sampled = now;
+        }
+        ssize_t n = read(samples[0], buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        if (data == 0) work->first_audio_time = now_ns();
+        // a consumer that goes away ends the job, piper then gets SIGPIPE
+        failed = write_all(out, buf, n) < 0;
+        data += n;
+    }
+    close(samples[0]);
+
+    peak_watch(pid, &work->usage.max_rss_kb);
+    int status;
+    struct rusage ru;
+    while (wait4(pid, &status, 0, &ru) < 0 && errno == EINTR);
+    usage_from_rusage(&work->usage, &ru);
+    if (!work->fifo) {
+        wav_header(header, fmt, data);
+        if (pwrite(out, header, sizeof(header), 0) != sizeof(header)) failed = 1;
+    }
+    close(out);
+    // a fifo has no size of its own, finish_job takes it from here
+    if (work->fifo) work->out_size = failed || data == 0 ? 0 : data + sizeof(header);
+    work->streamed = !failed && data > 0;
+
+    if (failed || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        printf("jobsched-stream: piper did not finish job %d\n", work->jobid);
+        return -1;
+    }
+    return 0;
+}
+
+int piper_start(Job_list * queue, Piper * piper) {
+    // start a piper that reads json requests until its stdin closes
+    // the pipes are close-on-exec so children of other workers never hold them open
+    int to_child[2], from_child[2];
+    if (pipe2(to_child, O_CLOEXEC) < 0) {
+        printf("jobsched-pool: unable to create pipe: %s\n", strerror(errno));
+        return -1;
+    }
+    if (pipe2(from_child, O_CLOEXEC) < 0) {
+        printf("jobsched-pool: unable to create pipe: %s\n", strerror(errno));
+        close(to_child[0]);
+        close(to_child[1]);
+        return -1;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, to_child[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, from_child[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+    char * args[] = {"piper", "-m", PIPER_MODEL, "--json-input", NULL};
+    pid_t new_pid;
+    int err = posix_spawn(&new_pid, "piper/piper", &actions, NULL, args, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (err != 0) {
+        printf("jobsched-pool: unable to start piper: %s\n", strerror(err));
+        close(to_child[0]);
+        close(to_child[1]);
+        close(from_child[0]);
+        close(from_child[1]);
+        return -1;
+    }
+
+    close(to_child[0]);
+    close(from_child[1]);
+    piper->pid = new_pid;
+    piper->in = to_child[1];
+    piper->out = fdopen(from_child[0], "r");
+    piper->jobs = 0;
+    __sync_fetch_and_add(&queue->spawns, 1);
+    return 0;
+}
+
+void piper_stop(Piper * piper) {
+    // close the child's stdin so it exits, then reap it
+    if (piper->pid < 0) return;
+    close(piper->in);
+    fclose(piper->out);
+
+    int status;
+    waitpid(piper->pid, &status, 0);
+    if (WIFSIGNALED(status)) {
+        printf("jobsched-pool: piper %d was killed by signal %d after %zu jobs\n"
+                , piper->pid, WTERMSIG(status), piper->jobs);
+    }
+    piper->pid = -1;
+}
+
+char * pool_request(Job * work) {
+    // build the json line for one job: {"text": "...", "output_file": "jobN.wav"}
+    // piper reads a line per utterance so newlines in the text become spaces
+    char in[JOB_NAME_MAX], out[JOB_NAME_MAX];
+    FILE * file = fopen(job_input(work, in), "r");
+    if (!file) {
+        printf("jobsched-pool: unable to open %s: %s\n", job_input(work, in), strerror(errno));
+        return NULL;
+    }
+    job_output(work, out);
+    // worst case every byte is escaped
+    char * line = malloc(work->in_size * 2 + strlen(out) + 64);
+    char * end = line + sprintf(line, "{\"text\": \"");
+    int c;
+    while ((c = fgetc(file)) != EOF) {
+        if (c == '"' || c == '\\') {
+            *end++ = '\\';
+            *end++ = c;
+        }
+        else if (c < 0x20) {
+            *end++ = ' ';
+        }
+        else {
+            *end++ = c;
+        }
+    }
+    fclose(file);
+    sprintf(end, "\", \"output_file\": \"%s\"}\n", out);
+    return line;
+}
+
+int write_all(int fd, char * buf, size_t len) {
+    // write the whole buffer, returns -1 if the reader went away
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int process_json(Job_list * queue, Piper * piper, Job ** jobs, int n) {
+    // run one or more jobs on a --json-input piper
+    // every request is written up front and piper answers each one with the
+    // path it wrote, in order, so each job is finished as its answer arrives
+    // and its start time is when piper began working on it
+    // a child that dies is reaped and replaced, and unanswered jobs are retried once
+    char * requests[BATCH_MAX];
+    for (int i = 0; i < n; i++) {
+        requests[i] = pool_request(jobs[i]);
+    }
+
+    char * reply = NULL;
+    size_t reply_cap = 0;
+    int done = 0;
+    for (int attempt = 0; attempt < 2 && done < n; attempt++) {
+        if (piper->pid < 0 && piper_start(queue, piper) < 0) break;
+        // each answered job is charged what the piper used since the last answer
+        Usage before;
+        int measured = proc_usage(piper->pid, &before) == 0;
+
+        int sent = 1;
+        for (int i = done; i < n && sent; i++) {
+            if (requests[i]) {
+                sent = write_all(piper->in, requests[i], strlen(requests[i])) == 0;
+            }
+        }
+        while (sent && done < n) {
+            // a job whose input could not be read was never sent
+            if (!requests[done]) {
+                finish_job(queue, jobs[done++]);
+                continue;
+            }
+            ssize_t len = getline(&reply, &reply_cap, piper->out);
+            if (len <= 0) break;
+            if (reply[len - 1] == '\n') reply[len - 1] = 0;
+            char out[JOB_NAME_MAX];
+            if (strcmp(reply, job_output(jobs[done], out))) {
+                printf("jobsched-pool: piper answered %s for job %d\n", reply, jobs[done]->jobid);
+                break;
+            }
+            piper->jobs++;
+            Usage now;
+            if (measured && proc_usage(piper->pid, &now) == 0) {
+                Usage * usage = &jobs[done]->usage;
+                usage->cpu_ns = now.cpu_ns - before.cpu_ns;
+                usage->max_rss_kb = now.max_rss_kb;
+                usage->in_blocks = now.in_blocks - before.in_blocks;
+                usage->out_blocks = now.out_blocks - before.out_blocks;
+                usage->own = 0;
+                before = now;
+            }
+            finish_job(queue, jobs[done++]);
+            if (done < n) jobs[done]->start_time = now_ns();
+        }
+        if (done == n) break;
+
+        // the child is gone or out of step, start over with a fresh one
+        printf("jobsched-pool: piper %d failed on job %d, restarting it\n", piper->pid, jobs[done]->jobid);
+        piper_stop(piper);
+    }
+
+    // anything left failed twice, it finishes with no output. a piper that
+    // died partway may have left a truncated wav, which must not count as
+    // a success or be cached
+    int result = done == n ? 0 : -1;
+    while (done < n) {
+        char out[JOB_NAME_MAX];
+        unlink(job_output(jobs[done], out));
+        jobs[done]->cacheable = 0;
+        finish_job(queue, jobs[done++]);
+    }
+    for (int i = 0; i < n; i++) {
+        free(requests[i]);
+    }
+    free(reply);
+    return result;
+}
+
+int job_split(Job * parent, size_t split) {
+    // cut a large input into parts of about split bytes at sentence ends,
+    // each written to its own file in PART_DIR and prepared as a job
+    // returns the number of parts, 0 when the text is left whole
+    if (parent->in_size / split < 2) return 0;
+    FILE * file = fopen(parent->in_file, "r");
+    if (!file) return 0;
+    char * text = malloc(parent->in_size);
+    size_t len = text ? fread(text, 1, parent->in_size, file) : 0;
+    fclose(file);
+
+    // a part must have something besides whitespace to say
+    size_t last = len;
+    while (last > 0 && isspace((unsigned char) text[last - 1])) last--;
+
+    size_t wanted = len / split;
+    if (wanted > SPLIT_MAX_PARTS) wanted = SPLIT_MAX_PARTS;
+    size_t cuts[SPLIT_MAX_PARTS + 1];
+    size_t ncuts = 0;
+    cuts[ncuts++] = 0;
+    for (size_t k = 1; k < wanted; k++) {
+        size_t i = k * len / wanted;
+        if (i <= cuts[ncuts - 1]) i = cuts[ncuts - 1] + 1;
+        // the first sentence or line end at or after the even split point
+        for (; i < last; i++) {
+            char c = text[i - 1];
+            if (c == '\n' || ((c == '.' || c == '!' || c == '?') && isspace((unsigned char) text[i]))) break;
+        }
+        if (i >= last) break;
+        cuts[ncuts++] = i;
+    }
+    if (ncuts < 2) {
+        free(text);
+        return 0;
+    }
+    cuts[ncuts] = len;
+
+    mkdir(PART_DIR, 0755);
+    parent->parts = calloc(ncuts, sizeof(Job *));
+    int n = 0;
+    for (size_t k = 0; parent->parts && k < ncuts; k++) {
+        Job * part = job_alloc();
+        if (!part) break;
+        job_init(part);
+        // the part's file names come from its number
+        part->parent = parent;
+        part->part = k;
+        part->part_file = __atomic_fetch_add(&part_seq, 1, __ATOMIC_RELAXED);
+        part->cacheable = 0;
+        part->in_size = cuts[k + 1] - cuts[k];
+        char path[JOB_NAME_MAX];
+        job_input(part, path);
+        file = fopen(path, "w");
+        size_t wrote = file ? fwrite(text + cuts[k], 1, part->in_size, file) : 0;
+        if (!file || fclose(file) != 0 || wrote != part->in_size) {
+            unlink(path);
+            job_release(part);
+            break;
+        }
+        job_features(part, path);
+        parent->parts[n++] = part;
+    }
+    free(text);
+
+    // anything short of every part falls back to the whole file
+    if (n < (int) ncuts) {
+        parts_free(parent->parts, n);
+        parent->parts = NULL;
+        return 0;
+    }
+    parent->nparts = n;
+    parent->parts_left = n;
+    return n;
+}
+
+void parts_free(Job ** parts, int n) {
+    // remove the parts' files and free them, they are in no queue or list
+    parts_unlink(parts, n);
+    for (int i = 0; i < n; i++) {
+        job_release(parts[i]);
+    }
+    free(parts);
+}
+
+void parts_unlink(Job ** parts, int n) {
+    // remove the parts' input and output files
+    char path[JOB_NAME_MAX];
+    for (int i = 0; i < n; i++) {
+        unlink(job_input(parts[i], path));
+        unlink(job_output(parts[i], path));
+    }
+}
+
+uint32_t get32(unsigned char * p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+void put32(unsigned char * p, uint32_t v) {
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+void put16(unsigned char * p, uint16_t v) {
+    p[0] = v; p[1] = v >> 8;
+}
+
+void pcm_format(unsigned char * fmt, uint32_t rate) {
+    // the fmt chunk body of piper's raw output, mono 16 bit pcm
+    put16(fmt, 1);
+    put16(fmt + 2, 1);
+    put32(fmt + 4, rate);
+    put32(fmt + 8, rate * 2);
+    put16(fmt + 12, 2);
+    put16(fmt + 14, 16);
+}
+
+void wav_header(unsigned char * header, unsigned char * fmt, uint32_t data) {
+    // canonical 44 byte header for data bytes of samples
+    memcpy(header, "RIFF", 4);
+    put32(header + 4, 36 + data);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    put32(header + 16, 16);
+    memcpy(header + 20, fmt, 16);
+    memcpy(header + 36, "data", 4);
+    put32(header + 40, data);
+}
+
+uint32_t model_sample_rate(char * model) {
+    // "sample_rate" from the model's json config, next to the .onnx
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s.json", model);
+    FILE * file = fopen(path, "r");
+    if (!file) return DEFAULT_SAMPLE_RATE;
+    char line[1024];
+    long rate = 0;
+    while (!rate && fgets(line, sizeof(line), file)) {
+        char * key = strstr(line, "\"sample_rate\"");
+        if (key) rate = strtol(strchr(key + 13, ':') ? strchr(key + 13, ':') + 1 : "", NULL, 10);
+    }
+    fclose(file);
+    return rate > 0 ? rate : DEFAULT_SAMPLE_RATE;
+}
+
+int wav_concat(Job * parent) {
+    // join the parts' wavs in order into the parent's output, under one
+    // header covering all of the samples. returns -1 if a part is missing,
+    // is not a wav or its format differs from the first
+    char path[JOB_NAME_MAX];
+    job_output(parent, path);
+    FILE * out = fopen(path, "w");
+    if (!out) {
+        printf("jobsched-split: unable to create %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    unsigned char header[44] = {0};
+    fwrite(header, 1, sizeof(header), out);
+
+    unsigned char fmt[16];
+    int have_fmt = 0;
+    uint32_t data = 0;
+    int ok = 1;
+    char buf[65536];
+    for (int k = 0; k < parent->nparts && ok; k++) {
+        char part_path[JOB_NAME_MAX];
+        FILE * in = fopen(job_output(parent->parts[k], part_path), "r");
+        unsigned char chunk[12];
+        ok = in && fread(chunk, 1, 12, in) == 12
+                && !memcmp(chunk, "RIFF", 4) && !memcmp(chunk + 8, "WAVE", 4);
+        int found = 0;
+        // walk the chunks to the samples, skipping any metadata
+        while (ok && !found && fread(chunk, 1, 8, in) == 8) {
+            uint32_t size = get32(chunk + 4);
+            if (!memcmp(chunk, "fmt ", 4)) {
+                unsigned char part_fmt[16];
+                if (size < 16 || fread(part_fmt, 1, 16, in) != 16) {
+                    ok = 0;
+                }
+                else if (!have_fmt) {
+                    memcpy(fmt, part_fmt, 16);
+                    have_fmt = 1;
+                }
+                else if (memcmp(fmt, part_fmt, 16)) {
+                    ok = 0;
+                }
+                fseeko(in, size - 16 + (size & 1), SEEK_CUR);
+            }
+            else if (!memcmp(chunk, "data", 4) && have_fmt) {
+                // to the end of the chunk, or of the file if piper left it unset
+                size_t n;
+                while (size > 0 && (n = fread(buf, 1, size < sizeof(buf) ? size : sizeof(buf), in)) > 0) {
+                    fwrite(buf, 1, n, out);
+                    size -= n;
+                    data += n;
+                }
+                found = 1;
+            }
+            else {
+                fseeko(in, (off_t) size + (size & 1), SEEK_CUR);
+            }
+        }
+        if (in) fclose(in);
+        if (!found) {
+            printf("jobsched-split: part %d of job %d has no usable wav\n", k, parent->jobid);
+            ok = 0;
+        }
+    }
+
+    wav_header(header, fmt, data);
+    fseeko(out, 0, SEEK_SET);
+    fwrite(header, 1, sizeof(header), out);
+    if (fclose(out) != 0) ok = 0;
+    if (!ok) unlink(path);
+    return ok ? 0 : -1;
+}
+
+void part_finish(Job_list * queue, Job * part) {
+    // record a finished part. the worker finishing the last one joins the
+    // outputs and finishes the parent job
+    char path[JOB_NAME_MAX];
+    size_t out_size = file_size(job_output(part, path));
+    part->out_time = now_ns();
+
+    pthread_mutex_lock(&mutex);
+    part->out_size = out_size;
+    __atomic_store_n(&part->state, JOB_DONE, __ATOMIC_RELEASE);
+    // every part is a real piper run, so the models learn from them
+    if (out_size > 0) {
+        model_learn(&queue->model, part);
+        rss_learn(queue, part);
+    }
+    heavy_done(queue, part);
+    Job * parent = part->parent;
+    usage_add(&parent->usage, &part->usage);
+    int last = --parent->parts_left == 0;
+    pthread_mutex_unlock(&mutex);
+    if (!last) return;
+
+    // nothing else touches the parts once they are all done
+    unlink(job_output(parent, path));
+    if (wav_concat(parent) < 0) parent->cacheable = 0;
+    Job ** parts = parent->parts;
+    pthread_mutex_lock(&mutex);
+    parent->parts = NULL;
+    pthread_mutex_unlock(&mutex);
+    parts_free(parts, parent->nparts);
+    finish_job(queue, parent);
+}
+
+size_t file_size(const char * filename) {
+    // return the filesize of a file
+    struct stat st;
+    if (lstat(filename, &st) != 0) {
+        printf("jobsched: Unable to stat %s: %s\n", filename, strerror(errno));
+        return 0;
+    }
+    return st.st_size;
+}
+
+Job * job_alloc(void) {
+    // a job record from the slabs, a new slab when every record is in use
+    pthread_mutex_lock(&store_lock);
+    if (!free_jobs) {
+        Job_slab * slab = malloc(sizeof(Job_slab));
+        if (!slab) {
+            pthread_mutex_unlock(&store_lock);
+            return NULL;
+        }
+        slab->next = slabs;
+        slabs = slab;
+        for (int i = JOB_SLAB - 1; i >= 0; i--) {
+            slab->jobs[i].next = free_jobs;
+            free_jobs = &slab->jobs[i];
+        }
+    }
+    Job * job = free_jobs;
+    free_jobs = job->next;
+    pthread_mutex_unlock(&store_lock);
+    return job;
+}
+
+void job_release(Job * job) {
+    pthread_mutex_lock(&store_lock);
+    job->next = free_jobs;
+    free_jobs = job;
+    pthread_mutex_unlock(&store_lock);
+}
+
+const char * intern(const char * path) {
+    // the shared copy of a path, made the first time it is seen
+    size_t len = strlen(path);
+    pthread_mutex_lock(&store_lock);
+    if ((interned_count + 1) * 2 > interned_cap) {
+        size_t cap = interned_cap ? interned_cap * 2 : 1024;
+        char ** table = calloc(cap, sizeof(char *));
+        if (!table) {
+            pthread_mutex_unlock(&store_lock);
+            return NULL;
+        }
+        for (size_t i = 0; i < interned_cap; i++) {
+            if (!interned[i]) continue;
+            size_t slot = fnv1a(0xcbf29ce484222325ull, interned[i], strlen(interned[i])) & (cap - 1);
+            while (table[slot]) slot = (slot + 1) & (cap - 1);
+            table[slot] = interned[i];
+        }
+        free(interned);
+        interned = table;
+        interned_cap = cap;
+    }
+
+    size_t slot = fnv1a(0xcbf29ce484222325ull, path, len) & (interned_cap - 1);
+    for (; interned[slot]; slot = (slot + 1) & (interned_cap - 1)) {
+        if (!strcmp(interned[slot], path)) {
+            pthread_mutex_unlock(&store_lock);
+            return interned[slot];
+        }
+    }
+
+    // a long path gets a block of its own, so the one being filled keeps its room
+    size_t size = len + 1 > INTERN_BLOCK / 4 ? sizeof(char *) + len + 1 : INTERN_BLOCK;
+    if (size != INTERN_BLOCK || len + 1 > intern_left) {
+        char * block = malloc(size);
+        if (!block) {
+            pthread_mutex_unlock(&store_lock);
+            return NULL;
+        }
+        *(char **) block = intern_blocks;
+        intern_blocks = block;
+        if (size == INTERN_BLOCK) {
+            intern_fill = block + sizeof(char *);
+            intern_left = INTERN_BLOCK - sizeof(char *);
+        }
+        else {
+            interned[slot] = memcpy(block + sizeof(char *), path, len + 1);
+            interned_count++;
+            pthread_mutex_unlock(&store_lock);
+            return interned[slot];
+        }
+    }
+    char * copy = memcpy(intern_fill, path, len + 1);
+    intern_fill += len + 1;
+    intern_left -= len + 1;
+    interned[slot] = copy;
+    interned_count++;
+    pthread_mutex_unlock(&store_lock);
+    return copy;
+}
+
+void store_free(void) {
+    // every slab and interned path, at exit
+    while (slabs) {
+        Job_slab * next = slabs->next;
+        free(slabs);
+        slabs = next;
+    }
+    while (intern_blocks) {
+        char * next = *(char **) intern_blocks;
+        free(intern_blocks);
+        intern_blocks = next;
+    }
+    free(interned);
+}
+
+char * job_output(Job * job, char * buf) {
+    // the file a job's audio goes to, buf holds JOB_NAME_MAX bytes
+    if (job->parent) {
+        snprintf(buf, JOB_NAME_MAX, "%s/%d.%u.wav", PART_DIR, (int) getpid(), job->part_file);
+    }
+    else {
+        snprintf(buf, JOB_NAME_MAX, "job%d.wav", job->jobid);
+    }
+    return buf;
+}
+
+const char * job_input(Job * job, char * buf) {
+    // the file piper reads, buf holds JOB_NAME_MAX bytes
+    if (!job->parent) return job->in_file;
+    snprintf(buf, JOB_NAME_MAX, "%s/%d.%u.txt", PART_DIR, (int) getpid(), job->part_file);
+    return buf;
+}
+
+void job_init(Job * job) {
+    // a waiting job with nothing known about it yet
+    memset(job, 0, sizeof(Job));
+    job->state = JOB_WAITING;
+    job->pid = -1;
+    job->run_slot = -1;
+    job->runq = -1;
+    job->cacheable = 1;
+    job->heap_pos[HEAP_READY] = HEAP_NONE;
+    job->heap_pos[HEAP_ARRIVAL] = HEAP_NONE;
+    job->heap_pos[HEAP_PAUSED] = HEAP_NONE;
+}
+
+Job * job_prepare(char * filename, size_t split) {
+    // allocate and fill in a job for a file, everything that does not need
+    // the lock. returns NULL if the file cannot be submitted
+    // with split set, a large file is also cut into parts
+    Job * new = job_alloc();
+    if (!new) {
+        fprintf(reply, "jobsched-submit: unable to allocate a job for %s\n", filename);
+        return NULL;
+    }
+    job_init(new);
+
+    new->in_size = file_size(filename);
+    // handle a file that doesn't exist
+    if (new->in_size == 0) {
+        fprintf(reply, "jobsched-submit: %s is empty or non-existent, not adding to queue\n", filename);
+        job_release(new);
+        return NULL;
+    }
+
+    new->in_file = intern(filename);
+    if (!new->in_file) {
+        fprintf(reply, "jobsched-submit: unable to store the name %s\n", filename);
+        job_release(new);
+        return NULL;
+    }
+
+    // counted outside the lock, only the prediction needs the model
+    job_features(new, new->in_file);
+    if (split > 0) job_split(new, split);
+    return new;
+}
+
+int job_admit(Job_list * queue, Job * new) {
+    // queue a prepared job that has its id and in_time, must be called with
+    // the mutex held. returns 1 if the output cache finished it, 0 if it is
+    // waiting, and -1 if it could not be queued, in which case it has been freed
+    // the caller counts it in queue->waiting and wakes the workers, once
+    // for each part of a split job
+    // workers admit jobs too, so errors go to stdout rather than the reply
+    new->predicted_run = model_predict(&queue->model, new);
+    // only the shared queue holds heavy jobs back
+    new->heavy = queue->shared.heavy_cap > 0 && rss_predict(queue, new) >= queue->heavy_kb;
+
+    if (index_insert(queue, new) < 0) {
+        printf("jobsched-submit: unable to index job %d (%s)\n", new->jobid, new->in_file);
+        parts_free(new->parts, new->nparts);
+        job_release(new);
+        return -1;
+    }
+
+    // identical text that was already synthesized finishes right away,
+    // submit has linked the output already
+    int cached = new->cached;
+    int pushed = 0;
+    if (cached) {
+        // a split job found in the cache has no use for its parts
+        parts_free(new->parts, new->nparts);
+        new->parts = NULL;
+        new->nparts = 0;
+        new->start_time = new->out_time = new->first_audio_time = now_ns();
+        new->state = JOB_DONE;
+        new->policy = queue->mode;
+        __atomic_add_fetch(&queue->total_output_size, new->out_size, __ATOMIC_RELAXED);
+        queue->done++;
+        totals_done(queue, new, 1);
+        output_kept(queue, new);
+    }
+    // steal dispatch spreads jobs over the workers' run queues
+    else if (queue->nrunq > 0) {
+        fair_tag(queue, new);
+        new->runq = queue->next_runq++ % queue->nrunq;
+        Run_queue * rq = &queue->runq[new->runq];
+        pthread_mutex_lock(&rq->lock);
+        pushed = runq_push(rq, new);
+        pthread_mutex_unlock(&rq->lock);
+    }
+    // a split job is queued as its parts
+    else if (new->parts) {
+        int i;
+        for (i = 0; i < new->nparts && pushed == 0; i++) {
+            Job * part = new->parts[i];
+            part->jobid = new->jobid;
+            part->in_time = new->in_time;
+            part->priority = new->priority;
+            part->deadline = new->deadline;
+            part->tenant = new->tenant;
+            part->predicted_run = model_predict(&queue->model, part);
+            fair_tag(queue, part);
+            part->heavy = queue->shared.heavy_cap > 0 && rss_predict(queue, part) >= queue->heavy_kb;
+            pushed = runq_push(&queue->shared, part);
+        }
+        if (pushed < 0) {
+            while (--i >= 0) runq_remove(&queue->shared, new->parts[i]);
+        }
+    }
+    else {
+        fair_tag(queue, new);
+        pushed = runq_push(&queue->shared, new);
+    }
+    if (pushed < 0) {
+        index_remove(queue, new->jobid);
+        printf("jobsched-submit: unable to queue job %d (%s)\n", new->jobid, new->in_file);
+        parts_free(new->parts, new->nparts);
+        job_release(new);
+        return -1;
+    }
+
+    Tenant * tenant = &queue->tenants[new->tenant];
+    if (!tenant->first_in) tenant->first_in = new->in_time;
+    queue->totals.in_size += new->in_size;
+
+    // handle empty list scenario
+    if (queue->count == 0) {
+        new->next = NULL;
+        new->prev = NULL;
+        queue->head = new;
+        queue->tail = new;
+    }
+    // add to a queue with stuff in it
+    else {
+        new->next = NULL;
+        queue->tail->next = new;
+        new->prev = queue->tail;
+        queue->tail = new;
+        
+    }
+    queue->count++;
+    return cached;
+}
+
+int tenant_find(Job_list * queue, const char * name, int add) {
+    // index of a tenant, with add set a new one gets a share of 1
+    // returns -1 if there is no such tenant or no room for it
+    // only the command loop thread calls this, so it needs no lock
+    for (int i = 0; i < queue->ntenants; i++) {
+        if (!strcmp(queue->tenants[i].name, name)) return i;
+    }
+    if (!add || queue->ntenants == MAX_TENANTS || strlen(name) >= TENANT_NAME_MAX) return -1;
+    Tenant * tenant = &queue->tenants[queue->ntenants];
+    memset(tenant, 0, sizeof(Tenant));
+    strcpy(tenant->name, name);
+    tenant->share = 1;
+    // published after it is filled in, workers and list only look below ntenants
+    __atomic_store_n(&queue->ntenants, queue->ntenants + 1, __ATOMIC_RELEASE);
+    return queue->ntenants - 1;
+}
+
+void fair_tag(Job_list * queue, Job * job) {
+    // a waiting job's virtual start, must be called with the mutex held
+    // it starts when its tenant's previous job is done or at the current
+    // virtual time, whichever is later, and takes its predicted runtime
+    // divided by the tenant's share. a tenant that falls behind its share
+    // has the earliest tags, and one that was idle starts at the front
+    // without credit for the time it did not use
+    Tenant * tenant = &queue->tenants[job->tenant];
+    uint64_t vtime = __atomic_load_n(&queue->vtime, __ATOMIC_RELAXED);
+    job->vstart = tenant->finish > vtime ? tenant->finish : vtime;
+    tenant->finish = job->vstart + (uint64_t) (job->predicted_run * 1e9 / tenant->share) + 1;
+}
+
+void set_tags(Job * job, Submit_tags * tags) {
+    // the class, deadline and tenant of a job whose in_time is set
+    job->priority = tags->priority;
+    job->tenant = tags->tenant;
+    job->deadline = tags->deadline_s > 0 ? job->in_time + (uint64_t) (tags->deadline_s * 1e9) : 0;
+}
+
+int submit (char * filename, Job_list * queue, Submit_tags * tags) {
+    // fill in the node, give it an id and hand it to the scheduler
+    // the global mutex is not taken unless a worker is asleep. a cached
+    // output is linked here, and the job is indexed and queued, or finished
+    // if it was cached, when the ingress is drained
+    Job * new = job_prepare(filename, __atomic_load_n(&queue->split_bytes, __ATOMIC_RELAXED));
+    if (!new) return 1;
+
+    new->jobid = __atomic_add_fetch(&queue->last_job_id, 1, __ATOMIC_RELAXED);
+    new->in_time = now_ns();
+    set_tags(new, tags);
+    int cached = cache_lookup(&queue->cache, new);
+    uint64_t start = now_ns();
+    // read before the push, a worker may finish and delete the job after it
+    int jobid = new->jobid;
+    int nparts = new->nparts;
+    ingress_push(queue, new);
+    __atomic_add_fetch(&queue->enqueue_ns, now_ns() - start, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&queue->enqueue_jobs, 1, __ATOMIC_RELAXED);
+
+    // print job id
+    fprintf(reply, "jobsched: Job %d started on file %s\n", jobid, filename);
+    if (cached) {
+        fprintf(reply, "jobsched: Job %d reused the cached output of identical text\n", jobid);
+    }
+    else if (nparts > 0) {
+        fprintf(reply, "jobsched: Job %d was split into %d parts\n", jobid, nparts);
+    }
+
+    return 0;
+}
 
-        // update the values
+void ingress_push(Job_list * queue, Job * job) {
+    // hand a submitted job to the scheduler without taking the mutex
+    Job * head = __atomic_load_n(&queue->ingress, __ATOMIC_RELAXED);
+    do {
+        job->next = head;
+    } while (!__atomic_compare_exchange_n(&queue->ingress, &head, job, 1
+                , __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+    // a push onto a non empty ingress needs no wakeup: whoever was woken
+    // for the job below it has not drained it yet, and takes this one too
+    if (head) return;
+    // pairs with worker_idle(): a worker counts itself idle and then looks
+    // at the ingress, this pushed and then looks at the idle count, so at
+    // least one side sees the other and no worker sleeps through the job.
+    // taking the mutex makes sure a worker that counted itself is already
+    // asleep, the signal is sent after so it wakes to a free mutex
+    if (__atomic_load_n(&queue->idle_workers, __ATOMIC_SEQ_CST) > 0) {
         pthread_mutex_lock(&mutex);
+        pthread_mutex_unlock(&mutex);
+        pthread_cond_signal(&work_cond);
+    }
+    // every worker is busy, a job that may preempt one should not wait for
+    // the next pool manager tick to be admitted
+    else if (__atomic_load_n(&queue->preempt, __ATOMIC_RELAXED)) {
+        pthread_cond_signal(&pool_cond);
+    }
+}
+
+size_t ingress_drain(Job_list * queue) {
+    // admit every job in the ingress, must be called with the mutex held
+    // returns how many queue entries became runnable, they are counted in
+    // queue->waiting and the workers are woken for them
+    if (!__atomic_load_n(&queue->ingress, __ATOMIC_ACQUIRE)) return 0;
+    Job * stack = __atomic_exchange_n(&queue->ingress, NULL, __ATOMIC_ACQUIRE);
+
+    // the stack is newest first, reversed it is in submission order
+    Job * ordered = NULL;
+    while (stack) {
+        Job * next = stack->next;
+        stack->next = ordered;
+        ordered = stack;
+        stack = next;
+    }
+
+    size_t runnable = 0;
+    size_t admitted = 0;
+    while (ordered) {
+        Job * job = ordered;
+        ordered = job->next;
+        if (job_admit(queue, job) == 0) runnable += job->nparts > 0 ? job->nparts : 1;
+        admitted++;
+    }
+    queue->drains++;
+    queue->drained += admitted;
+    if (runnable > 0) {
+        __atomic_add_fetch(&queue->waiting, runnable, __ATOMIC_SEQ_CST);
+        // one new job needs only one worker
+        if (runnable == 1) pthread_cond_signal(&work_cond);
+        else pthread_cond_broadcast(&work_cond);
+        preempt_check(queue);
+    }
+    return runnable;
+}
+
+int is_bulk(char * spec) {
+    // a directory, a glob pattern or an @manifest names many files
+    if (spec[0] == '@' || strpbrk(spec, "*?[")) return 1;
+    struct stat st;
+    return stat(spec, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+int add_name(char *** names, size_t * count, size_t * cap, char * name) {
+    // append a copy of name to a growing array
+    if (*count == *cap) {
+        size_t grown_cap = *cap ? *cap * 2 : 1024;
+        char ** grown = realloc(*names, grown_cap * sizeof(char *));
+        if (!grown) return -1;
+        *names = grown;
+        *cap = grown_cap;
+    }
+    (*names)[*count] = strdup(name);
+    if (!(*names)[*count]) return -1;
+    (*count)++;
+    return 0;
+}
+
+int by_name(const void * a, const void * b) {
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+int bulk_names(char * spec, char *** list, size_t * count) {
+    // expand a bulk submit into file names, in the order they get job ids
+    char ** names = NULL;
+    size_t cap = 0;
+    *count = 0;
+    *list = NULL;
+    int failed = 0;
+
+    if (spec[0] == '@') {
+        // one path per line, blank lines and # comments are skipped
+        FILE * manifest = fopen(spec + 1, "r");
+        if (!manifest) {
+            fprintf(reply, "jobsched-submit: unable to open manifest %s: %s\n", spec + 1, strerror(errno));
+            return -1;
+        }
+        char * line = NULL;
+        size_t line_cap = 0;
+        ssize_t len;
+        while (!failed && (len = getline(&line, &line_cap, manifest)) > 0) {
+            while (len > 0 && isspace((unsigned char) line[len - 1])) line[--len] = 0;
+            if (len == 0 || line[0] == '#') continue;
+            failed = add_name(&names, count, &cap, line) < 0;
+        }
+        free(line);
+        fclose(manifest);
+    }
+    else if (strpbrk(spec, "*?[")) {
+        glob_t matches;
+        int err = glob(spec, 0, NULL, &matches);
+        if (err != 0 && err != GLOB_NOMATCH) {
+            fprintf(reply, "jobsched-submit: unable to expand %s\n", spec);
+            return -1;
+        }
+        for (size_t i = 0; !failed && err == 0 && i < matches.gl_pathc; i++) {
+            failed = add_name(&names, count, &cap, matches.gl_pathv[i]) < 0;
+        }
+        if (err == 0) globfree(&matches);
+    }
+    else {
+        // every file in the directory, not its subdirectories or dot files
+        DIR * dir = opendir(spec);
+        if (!dir) {
+            fprintf(reply, "jobsched-submit: unable to open %s: %s\n", spec, strerror(errno));
+            return -1;
+        }
+        size_t dir_len = strlen(spec);
+        char * path = malloc(dir_len + 258);
+        struct dirent * ent;
+        while (!failed && path && (ent = readdir(dir))) {
+            if (ent->d_name[0] == '.' || ent->d_type == DT_DIR) continue;
+            sprintf(path, "%s%s%s", spec, spec[dir_len - 1] == '/' ? "" : "/", ent->d_name);
+            failed = add_name(&names, count, &cap, path) < 0;
+        }
+        failed |= !path;
+        free(path);
+        closedir(dir);
+        qsort(names, *count, sizeof(char *), by_name);
+    }
+
+    if (failed) {
+        fprintf(reply, "jobsched-submit: out of memory listing %s\n", spec);
+        for (size_t i = 0; i < *count; i++) free(names[i]);
+        free(names);
+        return -1;
+    }
+    *list = names;
+    return 0;
+}
+
+void * bulk_prepare(void * arg) {
+    // prepare jobs until the shared list runs out
+    Bulk_work * work = arg;
+    size_t i;
+    while ((i = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED)) < work->count) {
+        work->jobs[i] = job_prepare(work->names[i], work->split);
+    }
+    return NULL;
+}
+
+int submit_many(char * spec, Job_list * queue, Submit_tags * tags) {
+    // submit every file named by a directory, a glob or an @manifest
+    // the files are statted and hashed on several threads, then all the jobs
+    // are queued under one lock and the workers are woken once
+    size_t count;
+    char ** names;
+    if (bulk_names(spec, &names, &count) < 0) return 1;
+    if (count == 0) {
+        fprintf(reply, "jobsched-submit: no files found for %s\n", spec);
+        free(names);
+        return 1;
+    }
+
+    Bulk_work work;
+    work.names = names;
+    work.jobs = calloc(count, sizeof(Job *));
+    work.count = count;
+    work.next = 0;
+    work.split = __atomic_load_n(&queue->split_bytes, __ATOMIC_RELAXED);
+    if (!work.jobs) {
+        fprintf(reply, "jobsched-submit: unable to allocate %zu jobs\n", count);
+        for (size_t i = 0; i < count; i++) free(names[i]);
+        free(names);
+        return 1;
+    }
+
+    // this thread takes part too, so helpers are only started for big lists
+    pthread_t helpers[BULK_THREADS];
+    int started = 0;
+    while (started < BULK_THREADS && (size_t) (started + 1) * 64 < count) {
+        if (pthread_create(&helpers[started], NULL, bulk_prepare, &work) != 0) break;
+        started++;
+    }
+    bulk_prepare(&work);
+    for (int i = 0; i < started; i++) {
+        pthread_join(helpers[i], NULL);
+    }
+
+    // ids and cached outputs are given out before the lock is taken, only
+    // this thread submits so the ids still follow the jobs already submitted
+    for (size_t i = 0; i < count; i++) {
+        if (!work.jobs[i]) continue;
+        work.jobs[i]->jobid = __atomic_add_fetch(&queue->last_job_id, 1, __ATOMIC_RELAXED);
+        work.jobs[i]->in_time = now_ns();
+        set_tags(work.jobs[i], tags);
+        cache_lookup(&queue->cache, work.jobs[i]);
+    }
+
+    int first = 0;
+    int last = 0;
+    size_t admitted = 0;
+    size_t cached = 0;
+    // queue entries, counting each part of a split job
+    size_t runnable = 0;
+    pthread_mutex_lock(&mutex);
+    // jobs submitted earlier keep their place ahead of these
+    ingress_drain(queue);
+    for (size_t i = 0; i < count; i++) {
+        if (!work.jobs[i]) continue;
+        int result = job_admit(queue, work.jobs[i]);
+        if (result < 0) continue;
+        if (!first) first = work.jobs[i]->jobid;
+        last = work.jobs[i]->jobid;
+        admitted++;
+        cached += result;
+        if (result == 0) runnable += work.jobs[i]->nparts > 0 ? work.jobs[i]->nparts : 1;
+    }
+    if (runnable > 0) {
+        __atomic_add_fetch(&queue->waiting, runnable, __ATOMIC_SEQ_CST);
+        pthread_cond_broadcast(&work_cond);
+        preempt_check(queue);
+    }
+    pthread_mutex_unlock(&mutex);
+
+    if (admitted > 0) {
+        fprintf(reply, "jobsched: Jobs %d-%d started on %zu files from %s", first, last, admitted, spec);
+        if (cached > 0) fprintf(reply, ", %zu reused cached outputs", cached);
+        fprintf(reply, "\n");
+    }
+    if (admitted < count) {
+        fprintf(reply, "jobsched-submit: %zu of %zu files were not added\n", count - admitted, count);
+    }
+    for (size_t i = 0; i < count; i++) free(names[i]);
+    free(names);
+    free(work.jobs);
+    return admitted == count ? 0 : 1;
+}
+
+void totals_done(Job_list * queue, Job * job, int sign) {
+    // count a finished job in the list's totals, or with sign -1 take a
+    // deleted one back out, must hold the mutex. the sums are unsigned and
+    // wrap back correctly when a job is taken out. the largest peak rss is
+    // not taken back, it stays the largest of every job that finished
+    uint64_t s = (uint64_t) (int64_t) sign;
+    Totals * totals = &queue->totals;
+    totals->turnaround_ns += s * (job->out_time - job->in_time);
+    totals->response_ns += s * (job->start_time - job->in_time);
+    totals->paused_ns += s * job->paused_ns;
+    if (job->out_size > 0) {
+        totals->first_audio_ns += s * (job->first_audio_time - job->in_time);
+        totals->audio_jobs += s;
+    }
+    totals->cpu_ns += s * job->usage.cpu_ns;
+    totals->in_blocks += s * job->usage.in_blocks;
+    totals->out_blocks += s * job->usage.out_blocks;
+    if (sign > 0 && job->usage.max_rss_kb > totals->peak_rss_kb) totals->peak_rss_kb = job->usage.max_rss_kb;
+}
+
+void list_row(Job_list * queue, Job * curr, uint64_t now) {
+    // one job's line of list, from a copy taken under the mutex
+    // the columns are as wide as their headings in list_jobs()
+    int state = curr->state;
+    char out[JOB_NAME_MAX];
+    fprintf(reply, "%-7d%-9s%-16s%8li B  %-13s%9li B  %7.3fs"
+            , curr->jobid, state_names[state]
+            , curr->in_file, curr->in_size
+            , state == JOB_WAITING ? "" : job_output(curr, out), curr->out_size
+            , curr->predicted_run);
+    if (state == JOB_DONE) {
+        fprintf(reply, "  %9.3fs", run_seconds(curr));
+        Usage * usage = &curr->usage;
+        if (usage->cpu_ns > 0 || usage->max_rss_kb > 0) {
+            fprintf(reply, "  %7.3fs  %7.1f MB  %u/%u%s", usage->cpu_ns / 1e9
+                    , usage->max_rss_kb / 1024.0, usage->in_blocks, usage->out_blocks
+                    , usage->own ? "" : "  shared piper");
+        }
+    }
+    // tenant names never change once added
+    if (curr->tenant != 0) {
+        fprintf(reply, "  tenant %s", queue->tenants[curr->tenant].name);
+    }
+    if (curr->priority != PRIORITY_NORMAL) {
+        fprintf(reply, "  %s", priority_names[(int) curr->priority]);
+    }
+    if (curr->deadline && state == JOB_DONE) {
+        if (curr->out_time > curr->deadline) {
+            fprintf(reply, "  missed deadline by %.3fs", (curr->out_time - curr->deadline) / 1e9);
+        }
+        else {
+            fprintf(reply, "  met deadline");
+        }
+    }
+    else if (curr->deadline) {
+        if (now > curr->deadline) fprintf(reply, "  overdue by %.3fs", (now - curr->deadline) / 1e9);
+        else fprintf(reply, "  due in %.3fs", (curr->deadline - now) / 1e9);
+    }
+    if (curr->pinned) fprintf(reply, "  pinned");
+    if (curr->evicted) fprintf(reply, "  evicted");
+    if (curr->nparts > 0 && state == JOB_DONE) {
+        fprintf(reply, "  %d parts", curr->nparts);
+    }
+    else if (curr->nparts > 0) {
+        fprintf(reply, "  %d of %d parts done", curr->nparts - curr->parts_left, curr->nparts);
+    }
+    fprintf(reply, "\n");
+}
+
+size_t list_chunk(Job_list * queue, List_filter * filter, Job * rows, int * next) {
+    // copy up to LIST_CHUNK of the jobs the filter picks, starting at id
+    // *next, into rows. the mutex is held only while copying, and at most
+    // LIST_SCAN jobs are looked at. *next is left at the id to continue
+    // from, past filter->last when there are no more
+    pthread_mutex_lock(&mutex);
+    ingress_drain(queue);
+    // ids are in list order, so the walk starts at the first job with an
+    // id of at least *next. ids below the head are gone already, and the
+    // job the last chunk ended on is usually still there
+    int last = filter->last;
+    if (queue->tail && queue->tail->jobid < last) last = queue->tail->jobid;
+    if (queue->head && *next < queue->head->jobid) *next = queue->head->jobid;
+    // deleted jobs leave holes in the ids, each probe counts as a scanned
+    // job so a long run of them is crossed over several holds
+    Job * curr = NULL;
+    size_t scanned = 0;
+    while (!curr && *next <= last && scanned < LIST_SCAN) {
+        curr = index_find(queue, *next);
+        scanned++;
+        if (!curr) (*next)++;
+    }
+    if (!curr && *next <= last) {
+        pthread_mutex_unlock(&mutex);
+        return 0;
+    }
+
+    size_t n = 0;
+    for (; curr && curr->jobid <= last && n < LIST_CHUNK && scanned < LIST_SCAN; curr = curr->next) {
+        scanned++;
+        int state = __atomic_load_n(&curr->state, __ATOMIC_ACQUIRE);
+        if (filter->state >= 0 && state != filter->state) continue;
+        rows[n] = *curr;
+        rows[n].state = state;
+        n++;
+    }
+    if (curr && curr->jobid <= last) *next = curr->jobid;
+    else *next = filter->last == INT_MAX ? INT_MAX : filter->last + 1;
+    pthread_mutex_unlock(&mutex);
+    return n;
+}
+
+void list_jobs(Job_list * queue, List_filter * filter) {
+    // list the jobs the filter picks, then the summary of every job
+    // the jobs are copied a chunk at a time and printed with the mutex
+    // released, and the summary comes from totals kept as jobs change
+    // state, so a huge queue holds up the workers only briefly at a time
+    size_t shown = 0;
+    int next = filter->first;
+    if (!filter->summary) {
+        Job * rows = malloc(LIST_CHUNK * sizeof(Job));
+        if (!rows) {
+            fprintf(reply, "jobsched-list: unable to allocate a page of jobs\n");
+            return;
+        }
+        // header 
+        fprintf(reply, "JOBID  STATE    INPUT_FILENAME  INPUT_SIZE  OUTPUT_FILE  OUTPUT_SIZE  PRED_RUN  ACTUAL_RUN  CPU_TIME  PEAK_RSS    IO_BLOCKS_IN/OUT\n");
+        fprintf(reply, "__________________________________________________________________________________________________________________________________\n");
+        while (next <= filter->last && next != INT_MAX && (!filter->rows || shown < filter->rows)) {
+            size_t n = list_chunk(queue, filter, rows, &next);
+            uint64_t now = now_ns();
+            for (size_t i = 0; i < n; i++) {
+                // a page that ends inside a chunk continues at the next row
+                if (filter->rows && shown == filter->rows) {
+                    next = rows[i].jobid;
+                    break;
+                }
+                list_row(queue, &rows[i], now);
+                shown++;
+            }
+        }
+        free(rows);
+        fprintf(reply, "__________________________________________________________________________________________________________________________________\n");
+        if (filter->rows && shown == filter->rows && next <= filter->last && next != INT_MAX) {
+            fprintf(reply, "More jobs may follow, continue from id %d with: list %s%s%d-", next
+                    , filter->state >= 0 ? state_names[filter->state] : "", filter->state >= 0 ? " " : "", next);
+            if (filter->last != INT_MAX) fprintf(reply, "%d", filter->last);
+            fprintf(reply, " %zu\n", filter->rows);
+        }
+    }
+
+    pthread_mutex_lock(&mutex);
+    ingress_drain(queue);
+    Totals totals = queue->totals;
+    size_t count = queue->done;
+    size_t output_size = queue->total_output_size;
+    size_t spawns = queue->spawns;
+    size_t batches = queue->batches;
+    size_t sched_ns = queue->sched_ns;
+    size_t sched_jobs = queue->sched_jobs;
+    size_t enqueue_ns = queue->enqueue_ns;
+    size_t enqueue_jobs = queue->enqueue_jobs;
+    size_t drains = queue->drains;
+    size_t drained = queue->drained;
+    int live = queue->live_workers;
+    int idle = queue->idle_workers;
+    int min = queue->min_workers;
+    int max = queue->max_workers;
+    size_t samples = queue->model.samples;
+    double model_error = queue->model.abs_error;
+    int predict = queue->predict;
+    pthread_mutex_lock(&queue->cache.lock);
+    size_t cache_limit = queue->cache.limit;
+    size_t cache_hits = queue->cache.hits;
+    size_t cache_misses = queue->cache.misses;
+    size_t cache_evictions = queue->cache.evictions;
+    size_t cache_entries = queue->cache.entries;
+    size_t cache_bytes = queue->cache.bytes;
+    pthread_mutex_unlock(&queue->cache.lock);
+    size_t preemptions = queue->preemptions;
+    size_t paused = queue->paused.len;
+    Run_queue * shared = &queue->shared;
+    int heavy_cap = shared->heavy_cap;
+    int heavy_running = shared->heavy_running;
+    size_t heavy_held = heavy_running >= heavy_cap ? shared->heavy.len : 0;
+    size_t heavy_waiting = shared->heavy.len;
+    size_t heavy_kb = queue->heavy_kb;
+    size_t rss_samples = queue->rss_n;
+    size_t deadline_jobs[PRIORITIES];
+    size_t deadline_missed[PRIORITIES];
+    memcpy(deadline_jobs, queue->deadline_jobs, sizeof(deadline_jobs));
+    memcpy(deadline_missed, queue->deadline_missed, sizeof(deadline_missed));
+    size_t jobs = queue->count;
+    size_t waiting = queue->waiting;
+    size_t budget = queue->output_budget;
+    char evict = queue->evict;
+    size_t evictions = queue->evictions;
+    size_t evicted_bytes = queue->evicted_bytes;
+    size_t pinned = queue->pinned;
+    pthread_mutex_unlock(&mutex);
+    if (filter->summary) {
+        fprintf(reply, "Jobs: %zu, %zu waiting, %zu done\n", jobs, waiting, count);
+    }
+    fprintf(reply, "Total input file size: %li B\n", totals.in_size);
+    fprintf(reply, "Total output file size: %li B\n", output_size);
+    if (budget > 0) {
+        fprintf(reply, "Output budget: %.1f of %zu MB used, %s, %zu outputs evicted (%.1f MB), %zu pinned\n"
+                , output_size / 1048576.0, budget >> 20
+                , evict == 's' ? "stalling when full" : evict == 'a' ? "evicting the oldest" : "evicting the least recently used"
+                , evictions, evicted_bytes / 1048576.0, pinned);
+    }
+    else {
+        fprintf(reply, "Output budget: none, %zu outputs evicted (%.1f MB), %zu pinned\n"
+                , evictions, evicted_bytes / 1048576.0, pinned);
+    }
+    fprintf(reply, "Workers: %d running, %d idle, pool bounds %d-%d\n", live - idle, idle, min, max);
+    fprintf(reply, "Piper processes started: %zu\n", spawns);
+    fprintf(reply, "Batched piper runs: %zu\n", batches);
+    fprintf(reply, "Preemptions: %zu, %zu jobs paused now\n", preemptions, paused);
+    fprintf(reply, "Resources used: %.3fs cpu, largest peak rss %.1f MB, %zu blocks read, %zu written\n"
+            , totals.cpu_ns / 1e9, totals.peak_rss_kb / 1024.0, totals.in_blocks, totals.out_blocks);
+    size_t with_deadline = 0;
+    size_t missed = 0;
+    for (int i = 0; i < PRIORITIES; i++) {
+        with_deadline += deadline_jobs[i];
+        missed += deadline_missed[i];
+    }
+    if (with_deadline > 0) {
+        fprintf(reply, "Deadlines: %zu of %zu missed (%.1f%%)", missed, with_deadline, 100.0 * missed / with_deadline);
+        for (int i = 0; i < PRIORITIES; i++) {
+            if (deadline_jobs[i] == 0) continue;
+            fprintf(reply, ", %s %.1f%%", priority_names[i], 100.0 * deadline_missed[i] / deadline_jobs[i]);
+        }
+        fprintf(reply, "\n");
+    }
+    if (heavy_cap > 0) {
+        fprintf(reply, "Memory cap: %d of %d heavy jobs (predicted peak rss >= %.1f MB) running, %zu waiting, %zu held back, rss model from %zu jobs\n"
+                , heavy_running, heavy_cap, heavy_kb / 1024.0, heavy_waiting, heavy_held, rss_samples);
+    }
+    if (cache_limit > 0) {
+        fprintf(reply, "Output cache: %zu hits, %zu misses, %zu evictions, %zu outputs in %.1f of %zu MB\n"
+                , cache_hits, cache_misses, cache_evictions, cache_entries
+                , cache_bytes / 1048576.0, cache_limit >> 20);
+    }
+    else {
+        fprintf(reply, "Output cache: off, %zu hits, %zu misses\n", cache_hits, cache_misses);
+    }
+    fprintf(reply, "Runtime model: %zu jobs learned", samples);
+    if (samples > 0) {
+        fprintf(reply, ", mean prediction error %.3fs", model_error / samples);
+    }
+    fprintf(reply, ", scheduling on %s\n", predict ? "predicted runtime" : "input size");
+    if (sched_jobs > 0) {
+        fprintf(reply, "Scheduler overhead: %.2f us per job\n", sched_ns / 1000.0 / sched_jobs);
+    }
+    if (enqueue_jobs > 0) {
+        fprintf(reply, "Submit handoff: %.3f us per job, %zu jobs admitted in %zu batches\n"
+                , enqueue_ns / 1000.0 / enqueue_jobs, drained, drains);
+    }
+    if (count > 0) {
+        fprintf(reply, "Average turnaround time: %fs\n", totals.turnaround_ns / 1e9 / count);
+        fprintf(reply, "Average response time: %fs\n", totals.response_ns / 1e9 / count);
+        fprintf(reply, "Average time paused: %fs\n", totals.paused_ns / 1e9 / count);
+    }
+    if (totals.audio_jobs > 0) {
+        fprintf(reply, "Average time to first audio: %fs\n", totals.first_audio_ns / 1e9 / totals.audio_jobs);
+    }
+
+}
+
+void show_stats(Job_list * queue) {
+    // p50, p90, p99 and max of finished jobs for every policy that ran any
+    // values are bucket upper bounds, within 25% of the true percentile
+    pthread_mutex_lock(&mutex);
+    // copied so printing does not hold up the workers
+    Histogram hists[4 * POLICIES];
+    Histogram used[3 * POLICIES];
+    int ntenants = queue->ntenants;
+    Tenant * tenants = malloc(ntenants * sizeof(Tenant));
+    if (tenants) memcpy(tenants, queue->tenants, ntenants * sizeof(Tenant));
+    for (int i = 0; i < POLICIES; i++) {
+        hists[4 * i] = queue->response_hist[i];
+        hists[4 * i + 1] = queue->turnaround_hist[i];
+        hists[4 * i + 2] = queue->paused_hist[i];
+        hists[4 * i + 3] = queue->first_audio_hist[i];
+        used[3 * i] = queue->cpu_hist[i];
+        used[3 * i + 1] = queue->rss_hist[i];
+        used[3 * i + 2] = queue->io_hist[i];
+    }
+    pthread_mutex_unlock(&mutex);
+
+    int shown = 0;
+    fprintf(reply, "POLICY    METRIC      JOBS     P50_MS     P90_MS     P99_MS     MAX_MS\n");
+    char * metrics[] = {"response", "turnaround", "paused", "first_audio"};
+    for (int i = 0; i < 4 * POLICIES; i++) {
+        Histogram * hist = &hists[i];
+        if (hist->total == 0) continue;
+        fprintf(reply, "%-10s%-12s%-9lu%-11.3f%-11.3f%-11.3f%.3f\n", policy_names[i / 4]
+                , metrics[i % 4], (unsigned long) hist->total
+                , hist_percentile(hist, 0.50) / 1e3, hist_percentile(hist, 0.90) / 1e3
+                , hist_percentile(hist, 0.99) / 1e3, hist->max / 1e3);
+        shown++;
+    }
+    if (shown == 0) {
+        fprintf(reply, "no finished jobs\n");
+        free(tenants);
+        return;
+    }
+
+    // what each job's piper used, cpu in ms, peak rss in MB and block i/o
+    fprintf(reply, "POLICY    RESOURCE    JOBS     P50        P90        P99        MAX\n");
+    char * resources[] = {"cpu_ms", "rss_mb", "io_blocks"};
+    // values are kept in the histograms' microseconds
+    double scale[] = {1e3, 1024, 1};
+    for (int i = 0; i < 3 * POLICIES; i++) {
+        Histogram * hist = &used[i];
+        if (hist->total == 0) continue;
+        double unit = scale[i % 3];
+        fprintf(reply, "%-10s%-12s%-9lu%-11.3f%-11.3f%-11.3f%.3f\n", policy_names[i / 3]
+                , resources[i % 3], (unsigned long) hist->total
+                , hist_percentile(hist, 0.50) / unit, hist_percentile(hist, 0.90) / unit
+                , hist_percentile(hist, 0.99) / unit, hist->max / unit);
+    }
+
+    // with tenants, how the workers' time was divided and what each one saw
+    if (!tenants || ntenants < 2) {
+        free(tenants);
+        return;
+    }
+    double shares = 0;
+    uint64_t run_ns = 0;
+    for (int i = 0; i < ntenants; i++) {
+        if (tenants[i].done == 0) continue;
+        shares += tenants[i].share;
+        run_ns += tenants[i].run_ns;
+    }
+    fprintf(reply, "TENANT          SHARE%%  WORK%%   JOBS     JOBS_S    RESP_P50   RESP_P99   TURN_P99\n");
+    for (int i = 0; i < ntenants; i++) {
+        Tenant * tenant = &tenants[i];
+        if (tenant->done == 0) continue;
+        double span = (tenant->last_out - tenant->first_in) / 1e9;
+        fprintf(reply, "%-16s%-8.1f%-8.1f%-9zu%-10.2f%-11.3f%-11.3f%.3f\n", tenant->name
+                , 100 * tenant->share / shares, run_ns ? 100.0 * tenant->run_ns / run_ns : 0
+                , tenant->done, span > 0 ? tenant->done / span : 0
+                , hist_percentile(&tenant->response, 0.50) / 1e3
+                , hist_percentile(&tenant->response, 0.99) / 1e3
+                , hist_percentile(&tenant->turnaround, 0.99) / 1e3);
+    }
+    free(tenants);
+}
+
+void nthreads(int min, int max, Job_list * queue) {
+    // sets the bounds of the worker pool, starting it the first time
+    // the pool manager grows the pool toward the load and idle workers
+    // above the minimum retire, so the number of threads stays in [min, max]
+    pthread_mutex_lock(&mutex);
+    ingress_drain(queue);
+    int first = queue->max_workers == 0;
+    queue->min_workers = min;
+    __atomic_store_n(&queue->max_workers, max, __ATOMIC_RELAXED);
+
+    // steal dispatch needs a run queue for every worker that may exist
+    if (queue->dispatch == 'w') {
+        if (!queue->runq) {
+            queue->runq = malloc(sizeof(Run_queue) * MAX_WORKERS);
+        }
+        int old = queue->nrunq;
+        for (int i = old; i < max; i++) {
+            runq_init(&queue->runq[i], queue->mode, queue->predict);
+        }
+        if (max > old) {
+            __atomic_store_n(&queue->nrunq, max, __ATOMIC_RELEASE);
+        }
+        // deal out the jobs submitted before the workers existed
+        Job * curr;
+        while ((curr = queue->shared.arrival.len ? queue->shared.arrival.items[0] : NULL)) {
+            runq_remove(&queue->shared, curr);
+            curr->runq = queue->next_runq++ % queue->nrunq;
+            runq_push(&queue->runq[curr->runq], curr);
+        }
+    }
+
+    if (first) {
+        pthread_t manager;
+        if (pthread_create(&manager, NULL, pool_manager, queue) != 0) {
+            fprintf(reply, "jobsched-nthreads: unable to start the pool manager\n");
+        }
+        else {
+            pthread_detach(manager);
+            queue->threads++;
+        }
+    }
+    // start the minimum now rather than on the next tick
+    while (queue->live_workers < min) {
+        if (start_worker(queue) < 0) break;
+    }
+    // idle workers above a lowered maximum retire when they wake
+    pthread_cond_broadcast(&work_cond);
+    pthread_cond_signal(&pool_cond);
+    pthread_mutex_unlock(&mutex);
+    return;    
+}
+
+int start_worker(Job_list * queue) {
+    // start one detached worker thread, must be called with the mutex held
+    Worker * args = malloc(sizeof(Worker));
+    if (!args) {
+        printf("jobsched-nthreads: unable to start a worker: out of memory\n");
+        return -1;
+    }
+    args->queue = queue;
+    args->id = queue->next_worker_id++;
+    if (queue->nrunq > 0) args->id %= queue->nrunq;
+
+    pthread_t thread;
+    // pthread_create returns its error rather than setting errno
+    int err = pthread_create(&thread, NULL, worker, args);
+    if (err != 0) {
+        printf("jobsched-nthreads: unable to start a worker: %s\n", strerror(err));
+        free(args);
+        return -1;
+    }
+    pthread_detach(thread);
+    // worker_retire() reads the count without the mutex
+    __atomic_fetch_add(&queue->live_workers, 1, __ATOMIC_RELAXED);
+    queue->threads++;
+    return 0;
+}
+
+void * pool_manager(void * arg) {
+    // grows the worker pool when jobs are waiting and nobody is idle
+    // each tick adds enough workers for the waiting jobs, unless the machine
+    // already has more runnable threads than cpus. then it adds one at a
+    // time, and only while jobs spend longer queued than running
+    Job_list * queue = arg;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) cpus = 1;
+
+    pthread_mutex_lock(&mutex);
+    while (!queue->shutdown) {
+        // jobs submitted while every worker was busy
+        ingress_drain(queue);
+        // held back heavy jobs are no reason for more workers
+        size_t waiting = runnable_jobs(queue);
+        int grow = 0;
+        if (waiting > (size_t) queue->idle_workers) {
+            grow = waiting - queue->idle_workers;
+            double load;
+            if (getloadavg(&load, 1) == 1 && load >= cpus) {
+                grow = queue->recent_response > queue->recent_run ? 1 : 0;
+            }
+        }
+        if (grow > queue->max_workers - queue->live_workers) {
+            grow = queue->max_workers - queue->live_workers;
+        }
+        // the minimum is kept no matter the load
+        if (queue->live_workers + grow < queue->min_workers) {
+            grow = queue->min_workers - queue->live_workers;
+        }
+        for (int i = 0; i < grow; i++) {
+            if (start_worker(queue) < 0) break;
+        }
+
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += POOL_TICK_MS * 1000000L;
+        until.tv_sec += until.tv_nsec / 1000000000L;
+        until.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&pool_cond, &mutex, &until);
+    }
+    queue->threads--;
+    pthread_mutex_unlock(&mutex);
+    return NULL;
+}
+
+int worker_idle(Job_list * queue) {
+    // sleep until there is work, must be called with the mutex held
+    // returns -1 if this worker should retire instead, with live_workers
+    // already decremented
+    while (1) {
+        // over the maximum, or shutting down, even with jobs left
+        if (queue->live_workers > queue->max_workers) {
+            __atomic_fetch_sub(&queue->live_workers, 1, __ATOMIC_RELAXED);
+            return -1;
+        }
+        ingress_drain(queue);
+        if ((runnable_jobs(queue) > 0 || queue->paused.len > 0) && !output_full(queue)) {
+            break;
+        }
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += IDLE_RETIRE_S;
+
+        // counted idle before the ingress is looked at, see ingress_push()
+        __atomic_add_fetch(&queue->idle_workers, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&queue->ingress, __ATOMIC_SEQ_CST)) {
+            __atomic_sub_fetch(&queue->idle_workers, 1, __ATOMIC_SEQ_CST);
+            continue;
+        }
+        int err = pthread_cond_timedwait(&work_cond, &mutex, &until);
+        __atomic_sub_fetch(&queue->idle_workers, 1, __ATOMIC_SEQ_CST);
+        if (err == ETIMEDOUT && runnable_jobs(queue) == 0 && queue->paused.len == 0
+                && queue->live_workers > queue->min_workers) {
+            __atomic_fetch_sub(&queue->live_workers, 1, __ATOMIC_RELAXED);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int worker_retire(Job_list * queue) {
+    // called between jobs, retires the worker if the pool is over its maximum
+    if (__atomic_load_n(&queue->live_workers, __ATOMIC_RELAXED)
+            <= __atomic_load_n(&queue->max_workers, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    pthread_mutex_lock(&mutex);
+    int retire = queue->live_workers > queue->max_workers;
+    if (retire) __atomic_fetch_sub(&queue->live_workers, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&mutex);
+    return retire;
+}
+
+int steal_work(Job_list * queue, int id, Job ** batch) {
+    // get work in steal dispatch: the worker's own run queue first, then
+    // the others starting with its neighbour. no global lock is taken
+    // queues left behind by retired workers are drained the same way
+    int nrunq = __atomic_load_n(&queue->nrunq, __ATOMIC_ACQUIRE);
+    int n = take_batch(queue, &queue->runq[id % nrunq], batch);
+    for (int v = 1; n == 0 && v < nrunq; v++) {
+        n = take_batch(queue, &queue->runq[(id + v) % nrunq], batch);
+    }
+    return n;
+}
+
+void finish_job(Job_list * queue, Job * work) {
+    // record a finished job and wake whoever is waiting on it
+    // start_time was set when piper started on the job
+    if (work->parent) {
+        part_finish(queue, work);
+        return;
+    }
+    char path[JOB_NAME_MAX];
+    size_t out_size = work->fifo ? work->out_size : file_size(job_output(work, path));
+    work->out_time = now_ns();
+    if (!work->first_audio_time) work->first_audio_time = work->out_time;
+    // the links are made before the mutex is taken
+    if (out_size > 0 && work->cacheable) cache_store(&queue->cache, work, out_size);
+
+    pthread_mutex_lock(&mutex);
+
+    work->out_size = out_size;
+    __atomic_store_n(&work->state, JOB_DONE, __ATOMIC_RELEASE);
+    // a consumer's fifo leaves nothing on disk, so it is no part of the budget
+    if (!work->fifo) __atomic_add_fetch(&queue->total_output_size, work->out_size, __ATOMIC_RELAXED);
+    queue->done++;
+    totals_done(queue, work, 1);
+    // only successful runs say anything about how long piper takes
+    if (out_size > 0) {
+        // a split job's parts ran side by side, they taught the model already
+        if (work->nparts == 0) {
+            model_learn(&queue->model, work);
+            rss_learn(queue, work);
+        }
+    }
+    // after the cache has linked the output, it may be evicted right away
+    output_kept(queue, work);
+    heavy_done(queue, work);
+    // the pool manager compares these to decide whether to keep growing
+    queue->recent_response = 0.8 * queue->recent_response + 0.2 * (work->start_time - work->in_time) / 1e9;
+    queue->recent_run = 0.8 * queue->recent_run + 0.2 * run_seconds(work);
+    int policy = policy_index(work->policy);
+    hist_add(&queue->response_hist[policy], work->start_time - work->in_time);
+    hist_add(&queue->turnaround_hist[policy], work->out_time - work->in_time);
+    if (work->preemptions > 0) hist_add(&queue->paused_hist[policy], work->paused_ns);
+    // a job that failed did not make its deadline either
+    if (work->deadline) {
+        queue->deadline_jobs[(int) work->priority]++;
+        if (work->out_time > work->deadline || out_size == 0) queue->deadline_missed[(int) work->priority]++;
+    }
+    if (out_size > 0) hist_add(&queue->first_audio_hist[policy], work->first_audio_time - work->in_time);
+    Tenant * tenant = &queue->tenants[work->tenant];
+    tenant->done++;
+    tenant->run_ns += work->out_time - work->start_time - work->paused_ns;
+    tenant->last_out = work->out_time;
+    hist_add(&tenant->response, work->start_time - work->in_time);
+    hist_add(&tenant->turnaround, work->out_time - work->in_time);
+    // a job that never got a piper has no usage to record
+    if (work->usage.cpu_ns > 0 || work->usage.max_rss_kb > 0) {
+        hist_add(&queue->cpu_hist[policy], work->usage.cpu_ns);
+        hist_add(&queue->rss_hist[policy], work->usage.max_rss_kb * 1000ull);
+        hist_add(&queue->io_hist[policy], (work->usage.in_blocks + (uint64_t) work->usage.out_blocks) * 1000);
+    }
+
+    // wake only the threads that can make progress
+    notify_waiters(queue, work, 1);
+    if (queue->all_waiters > 0 && queue->done == queue->count) {
+        wake_loop(queue);
+    }
+    pthread_mutex_unlock(&mutex);
+    evict_flush(queue);
+}
+
+void * worker(void * arg) {
+    // worker thread function
+    Worker * self = arg;
+    Job_list * queue = self->queue;
+
+    Job * batch[BATCH_MAX];
+    // this worker's warm piper, only started in pool mode
+    Piper piper;
+    piper.pid = -1;
+
+    while (!worker_retire(queue)) {
+        uint64_t sched_start = now_ns();
+        int n = 0;
+
+        if (queue->dispatch == 'w') {
+            // only touch the global mutex to admit submitted jobs, or to sleep
+            // when there is nothing anywhere
+            if (__atomic_load_n(&queue->ingress, __ATOMIC_RELAXED)) {
+                pthread_mutex_lock(&mutex);
+                ingress_drain(queue);
+                pthread_mutex_unlock(&mutex);
+            }
+            if (!output_full(queue)) {
+                n = steal_work(queue, self->id, batch);
+            }
+            if (n == 0) {
+                pthread_mutex_lock(&mutex);
+                int retire = worker_idle(queue);
+                pthread_mutex_unlock(&mutex);
+                if (retire < 0) break;
+                continue;
+            }
+        }
+        else {
+            // wait for an available job 
+            pthread_mutex_lock(&mutex);
+            ingress_drain(queue);
+            if ((runnable_jobs(queue) == 0 && queue->paused.len == 0)
+                    || output_full(queue)) {
+                if (worker_idle(queue) < 0) {
+                    pthread_mutex_unlock(&mutex);
+                    break;
+                }
+                // time spent idle is not scheduling overhead
+                sched_start = now_ns();
+            }
+
+            // a preempted job goes on where it stopped
+            Job * resumed = resume_job(queue);
+            if (resumed) {
+                pthread_mutex_unlock(&mutex);
+                if (piper_wait(queue, resumed) == 1) continue;
+                finish_job(queue, resumed);
+                continue;
+            }
+
+            // the heaps only hold waiting jobs so this is a pop, not a scan
+            n = next_batch(queue, &queue->shared, batch);
+            pthread_mutex_unlock(&mutex);
+        }
+        if (n == 0) {
+            printf("jobsched-worker: unable to find job: exiting!\n");
+            break;
+        }
+        __atomic_add_fetch(&queue->sched_ns, now_ns() - sched_start, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&queue->sched_jobs, n, __ATOMIC_RELAXED);
+        if (n > 1) __atomic_add_fetch(&queue->batches, 1, __ATOMIC_RELAXED);
+        char launch = __atomic_load_n(&queue->launch, __ATOMIC_RELAXED);
+        int stream = __atomic_load_n(&queue->stream, __ATOMIC_RELAXED);
+
+        // do the actual processing
+        // in a batch each later job's start is moved up when piper gets to it
+        uint64_t start = now_ns();
+        for (int i = 0; i < n; i++) {
+            batch[i]->start_time = start;
+            // a jobN.wav left over from an earlier run may be a link to a
+            // cached output, and piper would write straight into it
+            // a fifo a consumer is waiting on is kept for streaming
+            char out[JOB_NAME_MAX];
+            struct stat st;
+            job_output(batch[i], out);
+            if (!(stream && n == 1 && launch == 'e' && lstat(out, &st) == 0 && S_ISFIFO(st.st_mode))) {
+                unlink(out);
+            }
+        }
+        if (launch == 'p') {
+            process_json(queue, &piper, batch, n);
+        }
+        else if (n > 1) {
+            // one piper for the whole batch, started fresh like exec mode
+            Piper once;
+            once.pid = -1;
+            process_json(queue, &once, batch, n);
+            piper_stop(&once);
+        }
+        else {
+            // switching back to one piper per job, let the warm one go
+            piper_stop(&piper);
+            __sync_fetch_and_add(&queue->spawns, 1);
+            int result = stream ? process_stream(queue, batch[0]) : process(queue, batch[0]);
+            // a paused job is finished by whichever worker resumes it
+            if (result == 1) continue;
+            if (result < 0) batch[0]->cacheable = 0;
+            finish_job(queue, batch[0]);
+        }
+    }
 
-        shortest->start_time = start;
-        time(&shortest->out_time);
-        shortest->out_size = file_size(shortest->out_file_name);
-        shortest->job_stat = 1;
-        strcpy(shortest->job_status, "DONE");
-        queue->total_output_size += shortest->out_size;
-        queue->done++;
+    // retiring, let go of the warm piper
+    piper_stop(&piper);
+    free(self);
+    // the queue may be freed as soon as this is seen
+    pthread_mutex_lock(&mutex);
+    queue->threads--;
+    pthread_mutex_unlock(&mutex);
+    return NULL;
+}
 
-        pthread_cond_broadcast(&cond);
-        pthread_mutex_unlock(&mutex);
-     }
+void delete_queue(Job_list * queue) {
+    // quit exits at once, whatever is running. the workers and the pool
+    // manager are told to stop, and while any of them is still about the
+    // queue is not freed under it, the exit takes the memory back instead
+    Job * curr;
+    pthread_mutex_lock(&mutex);
+    queue->shutdown = 1;
+    queue->min_workers = 0;
+    __atomic_store_n(&queue->max_workers, 0, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&work_cond);
+    pthread_cond_broadcast(&pool_cond);
+    // paused pipers would otherwise stay stopped after jobsched exits
+    for (size_t i = 0; i < queue->paused.len; i++) {
+        kill(queue->paused.items[i]->pid, SIGCONT);
+    }
+    // split jobs leave part files behind either way
+    for (curr = queue->head; curr; curr = curr->next) {
+        if (curr->parts) parts_unlink(curr->parts, curr->nparts);
+    }
+    // never admitted, their part files still need removing
+    for (curr = queue->ingress; curr; curr = curr->next) {
+        if (curr->parts) parts_unlink(curr->parts, curr->nparts);
+    }
+    int threads = queue->threads;
+    pthread_mutex_unlock(&mutex);
+    evict_flush(queue);
+    if (threads > 0) return;
 
-     return NULL;
+    close(queue->wake_fd);
+    heap_free(&queue->paused);
+    heap_free(&queue->outputs);
+    heap_free(&queue->shared.ready);
+    heap_free(&queue->shared.heavy);
+    heap_free(&queue->shared.arrival);
+    for (int i = 0; i < queue->nrunq; i++) {
+        heap_free(&queue->runq[i].ready);
+        heap_free(&queue->runq[i].heavy);
+        heap_free(&queue->runq[i].arrival);
+    }
+    free(queue->runq);
+    free(queue->index);
+    cache_free(&queue->cache);
+    // the parts themselves go with the slabs
+    for (curr = queue->head; curr; curr = curr->next) free(curr->parts);
+    for (curr = queue->ingress; curr; curr = curr->next) free(curr->parts);
+    store_free();
+    free(queue);
 }
 
-void * balanced_worker(void * arg) {
-    // balanced worker function (same as sjf with passover handling)
-    Job_list * queue = arg;
-    // if a job has been passed over 4 times, run it the next time it comes up
-    int threshold = 3; 
+int run_command(Job_list * queue, Session * session, char * input) {
+    // run one command line, returns 1 for quit
+    char * words[MAX_WORDS + 1];
 
-    while (1) {
-        // find available job
-        pthread_mutex_lock(&mutex);
-        while (queue->waiting <= 0 || queue->total_output_size >= (1<<20) * 100) {
-            pthread_cond_wait(&cond, &mutex);
-        } 
-
-        // iterate through queue
-        Job * curr = queue->head;
-        Job * shortest = NULL;
-        while (curr) {
-            // if job is waiting
-            if (curr->job_stat == -1) {
-                // if shortest hasn't been set yet
-                if (!shortest) {
-                    shortest = curr;
+    // split the line into words
+    char * word_one;
+    char * word_two;
+
+    // split input 
+    words[0] = strtok(input, " \t\n");
+    // handle empty line
+    if (!words[0]) return 0;
+    // handle other word
+    int word_count;
+    for (word_count = 1; word_count < MAX_WORDS; word_count++) {
+        words[word_count] = strtok(NULL, " \t\n");
+        if (!words[word_count]) {
+            words[word_count] = 0;
+            break;
+        }
+    }
+    word_one = words[0];
+    word_two = words[1];
+    // handle instructions with more than two words
+    if (word_count == MAX_WORDS) {
+        fprintf(reply, "jobsched: too many arguments! Must pick from one of the \nspecified arguments, and only use up to %d words!\n", MAX_WORDS - 1);
+        return 0;
+    }        
+
+    if (!strcmp(word_one, "quit")) return 1;
+    
+    // add to job list
+    else if (!strcmp(word_one, "submit")) {
+        // handle improper call of submit
+        if (word_count < 2) {
+            fprintf(reply, "jobsched-submit: must use the format submit <text_filename>"
+                    " [priority=<interactive|normal|bulk>] [deadline=<seconds>] [tenant=<name>]!\n");
+            return 0;
+        }
+        Submit_tags tags = {PRIORITY_NORMAL, 0, 0};
+        for (int i = 2; i < word_count; i++) {
+            char * end = NULL;
+            if (!strncmp(words[i], "priority=", 9)) {
+                int found = -1;
+                for (int p = 0; p < PRIORITIES; p++) {
+                    if (!strcmp(words[i] + 9, priority_names[p])) found = p;
                 }
-                if (curr->passed_over >= threshold) {
-                    shortest = curr;
-                    break;
+                if (found < 0) {
+                    fprintf(reply, "jobsched-submit: priority must be interactive, normal or bulk\n");
+                    return 0;
+                }
+                tags.priority = found;
+            }
+            else if (!strncmp(words[i], "deadline=", 9)) {
+                tags.deadline_s = strtod(words[i] + 9, &end);
+                if (*end || end == words[i] + 9 || tags.deadline_s <= 0) {
+                    fprintf(reply, "jobsched-submit: deadline must be a positive number of seconds\n");
+                    return 0;
                 }
-                else if (curr->in_size < shortest->in_size) {
-                    // if passing over, add one to passover count
-                    shortest->passed_over++;
-                    printf("Job %d passed over %d times\n", shortest->jobid, shortest->passed_over);
-                    shortest = curr;
+            }
+            else if (!strncmp(words[i], "tenant=", 7)) {
+                tags.tenant = tenant_find(queue, words[i] + 7, 1);
+                if (tags.tenant < 0) {
+                    fprintf(reply, "jobsched-submit: unable to add tenant %s, names are up to %d characters"
+                            " and there can be %d tenants\n", words[i] + 7, TENANT_NAME_MAX - 1, MAX_TENANTS);
+                    return 0;
                 }
-                
             }
+            else {
+                fprintf(reply, "jobsched-submit: unknown option %s, use priority=, deadline= or tenant=\n", words[i]);
+                return 0;
+            }
+        }
 
-            // if passing over, add one to passover count
-            curr = curr->next;
-        }       
+        // submit the file, or every file a directory, glob or manifest names
+        if (is_bulk(word_two)) {
+            submit_many(word_two, queue, &tags);
+        }
+        else {
+            submit(word_two, queue, &tags);
+        }
+    }
 
-        if (!shortest) { 
-            printf("jobsched-sjf: unable to find job: EXITING!\n");
-            return (void*) -1;
+    // list the jobs
+    else if (!strcmp(word_one, "list")) {
+        List_filter filter = {-1, 1, INT_MAX, 0, 0};
+        for (int i = 1; i < word_count; i++) {
+            char * end;
+            int state = -1;
+            for (int j = 0; j < 4; j++) {
+                if (!strcasecmp(words[i], state_names[j])) state = j;
+            }
+            if (state >= 0) {
+                filter.state = state;
+            }
+            else if (!strcmp(words[i], "summary")) {
+                filter.summary = 1;
+            }
+            else if (strchr(words[i], '-')) {
+                // first-last, or first- for every id from first on
+                filter.first = strtol(words[i], &end, 10);
+                int valid = end != words[i] && *end == '-' && filter.first >= 1;
+                if (valid && end[1]) {
+                    char * start = end + 1;
+                    filter.last = strtol(start, &end, 10);
+                    valid = end != start && !*end && filter.last >= filter.first;
+                }
+                if (!valid) {
+                    fprintf(reply, "jobsched-list: an id range is <first>-<last> or <first>-\n");
+                    return 0;
+                }
+            }
+            else {
+                long rows = strtol(words[i], &end, 10);
+                if (*end || rows <= 0) {
+                    fprintf(reply, "jobsched-list: usage: list [waiting|running|paused|done|summary] [<first>-[<last>]] [<rows>]\n");
+                    return 0;
+                }
+                filter.rows = rows;
+            }
+        }
+        list_jobs(queue, &filter);
+    }
+    
+    // nthreads
+    else if (!strcmp(word_one, "nthreads")) {
+        if (word_count != 2 && word_count != 3) {
+            fprintf(reply, "jobsched-nthreads: usage must be nthreads <number-of-threads> or nthreads <min> <max>!\n");
+            return 0;
+        }
+        // one number is a fixed size pool
+        int min = atoi(word_two);
+        int max = word_count == 3 ? atoi(words[2]) : min;
+        if (min <= 0 || max < min || max > MAX_WORKERS) {
+            fprintf(reply, "jobsched-nthreads: error reading number of threads or invalid number! (need 1 <= min <= max <= %d)\n", MAX_WORKERS);
+            return 0;
         }
+        nthreads(min, max, queue);
+    }
 
-        // start processing job 
-        sprintf(shortest->out_file_name, "job%d.wav", shortest->jobid);
-        shortest->job_stat = 0;
-        strcpy(shortest->job_status, "RUNNING");
-        queue->waiting--;
-        pthread_mutex_unlock(&mutex);
+    // wait funcs
+    else if (!strcmp(word_one, "wait")) {
+        if (word_count != 2) {
+            fprintf(reply, "jobsched-wait: usage: wait <jobid>\n");
+            return 0;
+        }
+        
+        int jobid = atoi(word_two);
+        if (jobid <= 0) {
+            fprintf(reply, "jobsched-wait: error reading jobid!\n");
+            return 0;
+        }
+        waitfor(queue, session, jobid);
+    }
+    else if (!strcmp(word_one, "waitall")) {
+        if (word_count != 1) {
+            fprintf(reply, "jobsched-waitall: usage: waitall\n");
+            return 0;
+        }
+        wait_all(queue, session);
+    }
 
-        // do the actual processing
-        time_t start;
-        time(&start);
-        process(shortest);
+    // delete
+    else if (!strcmp(word_one, "delete")) {
+        if (word_count != 2) {
+            fprintf(reply, "jobsched-delete: usage: delete <jobid>\n");
+            return 0;
+        }
 
-        // update the values
-        pthread_mutex_lock(&mutex);
+        // turn jobid into int
+        int jobid = atoi(word_two);
+        if (jobid <= 0) {
+            fprintf(reply, "jobsched-delete: error reading jobid or invalid jobid!\n");
+            return 0;
+        }
 
-        shortest->start_time = start;
-        time(&shortest->out_time);
-        shortest->out_size = file_size(shortest->out_file_name);
-        shortest->job_stat = 1;
-        strcpy(shortest->job_status, "DONE");
-        queue->total_output_size += shortest->out_size;
-        queue->done++;
+        delete(queue, jobid);
+    }
 
-        pthread_cond_broadcast(&cond);
-        pthread_mutex_unlock(&mutex);
-     }
+    // schedule command
+    else if (!strcmp(word_one, "schedule")) {
+        if (word_count != 2) {
+            fprintf(reply, "jobsched-schedule: usage: schedule <fcfs|sjf|balanced|edf|fair>\n");
+            return 0;
+        }
 
-     return NULL;
-}
+        // change mode char 
+        if (!strcmp(word_two, "fcfs")) {
+            set_schedule(queue, 'f');
+        }
+        else if (!strcmp(word_two, "sjf")) {
+            set_schedule(queue, 's');
+        }
+        else if (!strcmp(word_two, "balanced")) {
+            set_schedule(queue, 'b');
+        }
+        else if (!strcmp(word_two, "edf")) {
+            set_schedule(queue, 'e');
+        }
+        else if (!strcmp(word_two, "fair")) {
+            set_schedule(queue, 'q');
+        }
+        else {
+            fprintf(reply, "jobsched-schedule: must choose from fcfs, sjf, balanced, edf, or fair\n");
+        }
+    }
 
-void delete_queue(Job_list * queue) {
-    Job * curr = queue->head;
+    // piper launch mode
+    else if (!strcmp(word_one, "piper")) {
+        if (word_count != 2) {
+            fprintf(reply, "jobsched-piper: usage: piper <exec|pool>\n");
+            return 0;
+        }
 
-    while (curr) {
-        free(curr->in_file);
-        free(curr->out_file_name);
-        Job * temp = curr;
-        curr = curr->next;
-        free(temp);
+        // workers pick up the new mode on their next job
+        pthread_mutex_lock(&mutex);
+        if (!strcmp(word_two, "exec")) {
+            __atomic_store_n(&queue->launch, 'e', __ATOMIC_RELAXED);
+        }
+        else if (!strcmp(word_two, "pool")) {
+            __atomic_store_n(&queue->launch, 'p', __ATOMIC_RELAXED);
+        }
+        else {
+            fprintf(reply, "jobsched-piper: must choose from exec or pool\n");
+        }
+        pthread_mutex_unlock(&mutex);
     }
-    free(queue);
-}
 
-int main (int argc, char ** argv) {
-    if (argc != 1) {
-        printf("jobsched: USAGE: ./jobsched\n");
-        return 1;
+    // runtime prediction
+    else if (!strcmp(word_one, "predict")) {
+        if (word_count != 2 || (strcmp(word_two, "on") && strcmp(word_two, "off"))) {
+            fprintf(reply, "jobsched-predict: usage: predict <on|off>\n");
+            return 0;
+        }
+        pthread_mutex_lock(&mutex);
+        queue->predict = !strcmp(word_two, "on");
+        pthread_mutex_unlock(&mutex);
+        // reorders the jobs that are already waiting
+        set_schedule(queue, queue->mode);
     }
 
-    //buffer to store lines
-    char * input = malloc(MAX_INPUT_LEN * sizeof(char));
-    // stores individual words
-    char ** words = malloc((MAX_INPUT_LEN + 3)  * sizeof(char));
-    // boolean to store nthreads usage
-    int nthreads_used = 0;
-
-    // head of the linked list
-    Job_list * queue = malloc(sizeof(Job_list));
-    queue->head = NULL;
-    queue->tail = NULL;
-    queue->last_job_id = 0;
-    queue->total_output_size = 0;
-    queue->done = 0;
-    int threads = 1;
-    char mode = 'f';
-    
-    while (1) {
-        // break statement
-        if (!fgets(input, MAX_INPUT_LEN, stdin)) break;
-        
-        // split the line into words
-        char * word_one;
-        char * word_two;
-
-        // split input 
-        words[0] = strtok(input, " \t\n");
-        // handle empty line
-        if (!words[0]) continue;
-        // handle other word
-        int word_count;
-        for (word_count = 1; word_count < MAX_WORDS; word_count++) {
-            words[word_count] = strtok(NULL, " \t\n");
-            if (!words[word_count]) {
-                words[word_count] = 0;
-                break;
+    // dispatch mode
+    else if (!strcmp(word_one, "dispatch")) {
+        if (word_count != 2) {
+            fprintf(reply, "jobsched-dispatch: usage: dispatch <shared|steal>\n");
+            return 0;
+        }
+        if (queue->max_workers > 0) {
+            fprintf(reply, "jobsched-dispatch: must be chosen before nthreads starts the workers\n");
+            return 0;
+        }
+        if (!strcmp(word_two, "shared")) {
+            queue->dispatch = 's';
+        }
+        else if (!strcmp(word_two, "steal")) {
+            // parts are only ever in the shared queue
+            int split_waiting = 0;
+            pthread_mutex_lock(&mutex);
+            ingress_drain(queue);
+            for (Job * curr = queue->head; curr; curr = curr->next) {
+                if (curr->parts) split_waiting = 1;
+            }
+            pthread_mutex_unlock(&mutex);
+            if (queue->split_bytes > 0 || split_waiting) {
+                fprintf(reply, "jobsched-dispatch: steal cannot be used with split jobs\n");
+                return 0;
+            }
+            if (queue->shared.heavy_cap > 0) {
+                fprintf(reply, "jobsched-dispatch: steal cannot be used with memcap\n");
+                return 0;
             }
+            queue->dispatch = 'w';
         }
-        word_one = words[0];
-        word_two = words[1];
-        // handle instructions with more than two words
-        if (word_count == MAX_WORDS) {
-            printf("jobsched: too many arguments! Must pick from one of the \nspecified arguments, and only use up to two words!\n");
-            continue;
-        }        
+        else {
+            fprintf(reply, "jobsched-dispatch: must choose from shared or steal\n");
+        }
+    }
 
-        if (!strcmp(word_one, "quit")) break;
-        
-        // add to job list
-        else if (!strcmp(word_one, "submit")) {
-            // handle improper call of submit
-            if (word_count != 2) {
-                printf("jobsched-submit: must use the format submit <text_filename>!\n");
-                continue;
-            }
+    // streaming piper's raw output into jobN.wav
+    else if (!strcmp(word_one, "stream")) {
+        if (word_count != 2) {
+            fprintf(reply, "jobsched-stream: usage: stream <on|off>\n");
+            return 0;
+        }
+        if (!strcmp(word_two, "on")) {
+            __atomic_store_n(&queue->stream, 1, __ATOMIC_RELAXED);
+        }
+        else if (!strcmp(word_two, "off")) {
+            __atomic_store_n(&queue->stream, 0, __ATOMIC_RELAXED);
+        }
+        else {
+            fprintf(reply, "jobsched-stream: must choose from on or off\n");
+        }
+    }
 
-            // submit the file
-            submit(word_two, queue);
+    // sentence level splitting of large inputs
+    else if (!strcmp(word_one, "split")) {
+        if (word_count != 2) {
+            fprintf(reply, "jobsched-split: usage: split <part-bytes> | split off\n");
+            return 0;
+        }
+        if (!strcmp(word_two, "off")) {
+            __atomic_store_n(&queue->split_bytes, 0, __ATOMIC_RELAXED);
+            return 0;
+        }
+        char * end;
+        long bytes = strtol(word_two, &end, 10);
+        if (*end || bytes <= 0) {
+            fprintf(reply, "jobsched-split: part size must be a positive number of bytes\n");
+            return 0;
+        }
+        if (queue->dispatch == 'w') {
+            fprintf(reply, "jobsched-split: only available with shared dispatch\n");
+            return 0;
         }
+        __atomic_store_n(&queue->split_bytes, bytes, __ATOMIC_RELAXED);
+    }
 
-        // list the jobs
-        else if (!strcmp(word_one, "list")) {
-            if (word_count != 1) {
-                printf("jobsched-list: must use format: list\n");
-                continue;
-            }
-            list_jobs(queue);
+    // cap on memory heavy jobs running at once
+    else if (!strcmp(word_one, "memcap")) {
+        if (word_count == 2 && !strcmp(word_two, "off")) {
+            set_memcap(queue, 0, 0);
+            return 0;
         }
-        
-        // nthreads
-        else if (!strcmp(word_one, "nthreads")) {
-            if (word_count != 2) {
-                printf("jobsched-nthreads: usage must be nthreads <number-of-threads>!\n");
-            }
-            if (nthreads_used) {
-                printf("jobsched-nthreads: Only allowed to use once per runtime!!! no new threads started\n");
-                continue;
-            }
-            nthreads_used = 1;
-            threads = atoi(word_two);
-            if (threads == 0) {
-                printf("jobsched-nthreads: error reading number of threads or invalid number!\n");
-                continue;
-            }
-            nthreads(threads, queue, mode);
+        if (word_count != 3) {
+            fprintf(reply, "jobsched-memcap: usage: memcap <jobs> <megabytes> | memcap off\n");
+            return 0;
         }
+        char * end;
+        long jobs = strtol(word_two, &end, 10);
+        long mb = *end ? 0 : strtol(words[2], &end, 10);
+        if (*end || jobs <= 0 || mb <= 0) {
+            fprintf(reply, "jobsched-memcap: jobs and megabytes must be positive numbers\n");
+            return 0;
+        }
+        if (queue->dispatch == 'w') {
+            fprintf(reply, "jobsched-memcap: only available with shared dispatch\n");
+            return 0;
+        }
+        set_memcap(queue, jobs, (size_t) mb << 10);
+    }
 
-        // wait funcs
-        else if (!strcmp(word_one, "wait")) {
-            if (word_count != 2) {
-                printf("jobsched-wait: usage: wait <jobid>\n");
-                continue;
+    // shortest remaining time preemption
+    else if (!strcmp(word_one, "preempt")) {
+        if (word_count != 2) {
+            fprintf(reply, "jobsched-preempt: usage: preempt <on|off>\n");
+            return 0;
+        }
+        if (!strcmp(word_two, "on")) {
+            if (queue->dispatch == 'w') {
+                fprintf(reply, "jobsched-preempt: only available with shared dispatch\n");
+                return 0;
             }
-            
-            int jobid = atoi(word_two);
-            if (jobid <= 0) {
-                printf("jobsched-wait: error reading jobid!\n");
-                continue;
+            __atomic_store_n(&queue->preempt, 1, __ATOMIC_RELAXED);
+            if (queue->mode != 's' && queue->mode != 'b') {
+                fprintf(reply, "jobsched-preempt: takes effect under sjf and balanced\n");
             }
-            waitfor(queue, jobid);
         }
-        else if (!strcmp(word_one, "waitall")) {
-            if (word_count != 1) {
-                printf("jobsched-waitall: usage: waitall\n");
-                continue;
-            }
-            wait_all(queue);
+        else if (!strcmp(word_two, "off")) {
+            __atomic_store_n(&queue->preempt, 0, __ATOMIC_RELAXED);
         }
+        else {
+            fprintf(reply, "jobsched-preempt: must choose from on or off\n");
+        }
+    }
 
-        // delete
-        else if (!strcmp(word_one, "delete")) {
-            if (word_count != 2) {
-                printf("jobsched-delete: usage: delete <jobid>\n");
-                continue;
-            }
-
-            // turn jobid into int
-            int jobid = atoi(word_two);
-            if (jobid <= 0) {
-                printf("jobsched-delete: error reading jobid or invalid jobid!\n");
-                continue;
-            }
+    // fair share weights
+    else if (!strcmp(word_one, "share")) {
+        if (word_count != 3) {
+            fprintf(reply, "jobsched-share: usage: share <tenant> <weight>\n");
+            return 0;
+        }
+        char * end;
+        double share = strtod(words[2], &end);
+        if (*end || end == words[2] || share <= 0 || share > 1e6) {
+            fprintf(reply, "jobsched-share: weight must be a positive number\n");
+            return 0;
+        }
+        int tenant = tenant_find(queue, word_two, 1);
+        if (tenant < 0) {
+            fprintf(reply, "jobsched-share: unable to add tenant %s, names are up to %d characters"
+                    " and there can be %d tenants\n", word_two, TENANT_NAME_MAX - 1, MAX_TENANTS);
+            return 0;
+        }
+        // jobs already waiting keep their tags, the new weight applies to
+        // jobs admitted from now on
+        pthread_mutex_lock(&mutex);
+        queue->tenants[tenant].share = share;
+        pthread_mutex_unlock(&mutex);
+        if (queue->mode != 'q') {
+            fprintf(reply, "jobsched-share: takes effect under fair\n");
+        }
+    }
 
-            delete(queue, jobid);
+    // micro batching
+    else if (!strcmp(word_one, "batch")) {
+        if (word_count != 3 && word_count != 4) {
+            fprintf(reply, "jobsched-batch: usage: batch <fcfs|sjf|balanced|edf|fair> <max-bytes> <max-jobs> | batch <policy> off\n");
+            return 0;
+        }
+        int policy = -1;
+        for (int i = 0; i < POLICIES; i++) {
+            if (!strcmp(word_two, policy_names[i])) policy = i;
+        }
+        if (policy < 0) {
+            fprintf(reply, "jobsched-batch: must choose from fcfs, sjf, balanced, edf, or fair\n");
+            return 0;
         }
 
-        // schedule command
-        else if (!strcmp(word_one, "schedule")) {
-            if (word_count != 2) {
-                printf("jobsched-schedule: usage: schedule <fcfs|sjf|balanced>\n");
-                continue;
+        long bytes = 0;
+        int jobs = 0;
+        if (word_count == 3) {
+            if (strcmp(words[2], "off")) {
+                fprintf(reply, "jobsched-batch: usage: batch <policy> off\n");
+                return 0;
             }
-
-            // change mode char 
-            if (!strcmp(word_two, "fcfs")) {
-                mode = 'f';
+        }
+        else {
+            bytes = atol(words[2]);
+            jobs = atoi(words[3]);
+            if (bytes <= 0 || jobs < 2 || jobs > BATCH_MAX) {
+                fprintf(reply, "jobsched-batch: max-bytes must be positive and max-jobs between 2 and %d\n", BATCH_MAX);
+                return 0;
             }
-            else if (!strcmp(word_two, "sjf")) {
-                mode = 's';
+        }
+        __atomic_store_n(&queue->batch_bytes[policy], bytes, __ATOMIC_RELAXED);
+        __atomic_store_n(&queue->batch_jobs[policy], jobs, __ATOMIC_RELAXED);
+    }
+
+    // output cache size
+    else if (!strcmp(word_one, "cache")) {
+        if (word_count != 2) {
+            fprintf(reply, "jobsched-cache: usage: cache <megabytes|off>\n");
+            return 0;
+        }
+        long mb = 0;
+        if (strcmp(word_two, "off")) {
+            mb = atol(word_two);
+            if (mb <= 0) {
+                fprintf(reply, "jobsched-cache: size must be a positive number of megabytes, or off\n");
+                return 0;
             }
-            else if (!strcmp(word_two, "balanced")) {
-                mode = 'b';
+        }
+        pthread_mutex_lock(&queue->cache.lock);
+        queue->cache.limit = (size_t) mb << 20;
+        pthread_mutex_unlock(&queue->cache.lock);
+        cache_trim(&queue->cache);
+    }
+
+    // room for finished outputs, and what happens when it runs out
+    else if (!strcmp(word_one, "budget")) {
+        if (word_count != 2 && word_count != 3) {
+            fprintf(reply, "jobsched-budget: usage: budget <megabytes|off> [lru|age|stall]\n");
+            return 0;
+        }
+        long mb = 0;
+        if (strcmp(word_two, "off")) {
+            mb = atol(word_two);
+            if (mb <= 0) {
+                fprintf(reply, "jobsched-budget: size must be a positive number of megabytes, or off\n");
+                return 0;
             }
+        }
+        char evict = 0;
+        if (word_count == 3) {
+            if (!strcmp(words[2], "lru")) evict = 'l';
+            else if (!strcmp(words[2], "age")) evict = 'a';
+            else if (!strcmp(words[2], "stall")) evict = 's';
             else {
-                printf("jobsched-schedule: must choose from fcfs, sjf, or balanced\n");
-            }
-        }
-
-        // help command
-        else if (!strcmp(word_one, "help")) {
-            printf("Jobsched: help\n"
-                   "        Usage: help\n"
-                   "        displays help message\n\n"
-                   "    Jobsched Functions: \n"
-                   "        submit: \n"
-                   "            usage: submit <filename> \n"
-                   "            Submits a file to the job queue\n"
-                   "        nthreads: \n"
-                   "            usage: nthreads <number of threads>\n"
-                   "            starts x worker threads to process the jobs\n"
-                   "            CAN ONLY BE CALLED ONCE PER JOBSCHED RUN\n"
-                   "        list: \n"
-                   "            usage: list\n"
-                   "            lists the jobs and their data\n"
-                   "        wait: \n"
-                   "            usage: wait <jobid>\n"
-                   "            waits for the job with the specified jobid \n"
-                   "        waitall:\n"
-                   "            usage: waitall\n"
-                   "            blocks untill all jobs are done\n"
-                   "        delete:\n"
-                   "            usage: delete <jobid>\n"
-                   "            deletes the specified job and the corresponding output file\n"
-                   "            WILL NOT DELETE FILES THAT ARE IN THE RUNNIGN STATE\n"
-                   "        schedule:\n"
-                   "            usage: schedule <fcfs|sjf|balanced>\n"
-                   "            selects the scheduling algorithm\n"
-                   "        quit:\n"
-                   "            usage: quit\n"
-                   "            gracefully exits\n");
-        }
-
-        // unknown command
+                fprintf(reply, "jobsched-budget: must choose from lru, age, or stall\n");
+                return 0;
+            }
+        }
+        pthread_mutex_lock(&mutex);
+        int full = output_full(queue);
+        __atomic_store_n(&queue->output_budget, (size_t) mb << 20, __ATOMIC_RELAXED);
+        if (evict) {
+            queue->evict = evict;
+            heap_rebuild(&queue->outputs, evict == 'a' ? by_finished : by_last_use);
+        }
+        evict_outputs(queue);
+        // a larger budget, or eviction, may let stalled workers run again
+        if (full && !output_full(queue)) pthread_cond_broadcast(&work_cond);
+        pthread_mutex_unlock(&mutex);
+    }
+
+    // keep an output whatever the budget
+    else if (!strcmp(word_one, "pin") || !strcmp(word_one, "unpin")) {
+        if (word_count != 2) {
+            fprintf(reply, "jobsched-pin: usage: %s <jobid>\n", word_one);
+            return 0;
+        }
+        int jobid = atoi(word_two);
+        if (jobid <= 0) {
+            fprintf(reply, "jobsched-pin: error reading jobid or invalid jobid!\n");
+            return 0;
+        }
+        set_pinned(queue, jobid, !strcmp(word_one, "pin"));
+    }
+
+    // whether waits hold back the commands after them
+    else if (!strcmp(word_one, "waitmode")) {
+        if (word_count != 2) {
+            fprintf(reply, "jobsched-waitmode: usage: waitmode <async|block>\n");
+            return 0;
+        }
+        if (!strcmp(word_two, "async")) {
+            session->block = 0;
+        }
+        else if (!strcmp(word_two, "block")) {
+            session->block = 1;
+        }
         else {
-            printf("jobsched: command \"%s\" not found. Try \"help\".\n", input);
+            fprintf(reply, "jobsched-waitmode: must choose from async or block\n");
         }
     }
 
+    // latency percentiles
+    else if (!strcmp(word_one, "stats")) {
+        show_stats(queue);
+    }
+
+    // help command
+    else if (!strcmp(word_one, "help")) {
+        fprintf(reply, "Jobsched: help\n"
+               "        Usage: help\n"
+               "        displays help message\n\n"
+               "    Jobsched Functions: \n"
+               "        submit: \n"
+               "            usage: submit <filename> \n"
+               "                   submit <directory|glob|@manifest>\n"
+               "                   submit <file> [priority=<interactive|normal|bulk>] [deadline=<seconds>] [tenant=<name>]\n"
+               "            Submits a file to the job queue. a directory, a glob\n"
+               "            pattern or a file listing one path per line submits many\n"
+               "            the priority and deadline are used by the edf schedule,\n"
+               "            the tenant by the fair schedule\n"
+               "        nthreads: \n"
+               "            usage: nthreads <number of threads>\n"
+               "                   nthreads <min> <max>\n"
+               "            starts worker threads to process the jobs. with two numbers\n"
+               "            the pool grows with the queue and shrinks when idle\n"
+               "            giving it again changes the pool bounds\n"
+               "        list: \n"
+               "            usage: list [waiting|running|paused|done|summary] [<first>-[<last>]] [<rows>]\n"
+               "            lists the jobs and their data, only those in a state or\n"
+               "            an id range, at most rows of them, or just the summary\n"
+               "        cache: \n"
+               "            usage: cache <megabytes|off>\n"
+               "            resubmitted text reuses the earlier output instead of running\n"
+               "            piper. sets the cache size, off empties and disables it\n"
+               "        budget: \n"
+               "            usage: budget <megabytes|off> [lru|age|stall]\n"
+               "            sets the room for finished outputs, 100 MB by default. over\n"
+               "            it the workers wait for deletes (stall, the default), or the\n"
+               "            least recently used (lru) or oldest (age) outputs are evicted\n"
+               "        pin, unpin: \n"
+               "            usage: pin <jobid>, unpin <jobid>\n"
+               "            keeps a job's output from being evicted, or lets it go again\n"
+               "        stats: \n"
+               "            usage: stats\n"
+               "            response and turnaround percentiles per scheduling policy,\n"
+               "            and the cpu, peak memory and i/o of each job's piper\n"
+               "        wait: \n"
+               "            usage: wait <jobid>\n"
+               "            reports when the job with the specified jobid is done\n"
+               "        waitall:\n"
+               "            usage: waitall\n"
+               "            reports when all jobs are done\n"
+               "        waitmode:\n"
+               "            usage: waitmode <async|block>\n"
+               "            async: wait and waitall report when they are answered and\n"
+               "            later commands run meanwhile (default)\n"
+               "            block: commands after a wait run once it is answered\n"
+               "        delete:\n"
+               "            usage: delete <jobid>\n"
+               "            deletes the specified job and the corresponding output file\n"
+               "            WILL NOT DELETE FILES THAT ARE IN THE RUNNIGN STATE\n"
+               "        schedule:\n"
+               "            usage: schedule <fcfs|sjf|balanced|edf|fair>\n"
+               "            selects the scheduling algorithm. edf runs interactive,\n"
+               "            then normal, then bulk jobs, earliest deadline first.\n"
+               "            fair divides worker time between tenants by their shares\n"
+               "        share:\n"
+               "            usage: share <tenant> <weight>\n"
+               "            sets a tenant's share of worker time under fair, 1 by default\n"
+               "        predict:\n"
+               "            usage: predict <on|off>\n"
+               "            on: sjf and balanced rank jobs by the runtime the model\n"
+               "            predicts from the text instead of by input size\n"
+               "        dispatch:\n"
+               "            usage: dispatch <shared|steal>\n"
+               "            shared: every worker takes jobs from one queue (default)\n"
+               "            steal: each worker has its own queue and idle workers\n"
+               "            take jobs from busy ones. must be set before nthreads\n"
+               "        batch:\n"
+               "            usage: batch <fcfs|sjf|balanced|edf|fair> <max-bytes> <max-jobs>\n"
+               "                   batch <fcfs|sjf|balanced|edf|fair> off\n"
+               "            runs small waiting jobs together in one piper, up to\n"
+               "            max-bytes of input and max-jobs jobs per run\n"
+               "        stream:\n"
+               "            usage: stream <on|off>\n"
+               "            on: exec mode jobs write audio into jobN.wav as piper\n"
+               "            produces it, or into a fifo made at jobN.wav beforehand\n"
+               "        split:\n"
+               "            usage: split <part-bytes> | split off\n"
+               "            inputs of at least twice part-bytes are cut at sentence\n"
+               "            ends into parts of about that size, which run in parallel\n"
+               "            and are joined into one jobN.wav\n"
+               "        preempt:\n"
+               "            usage: preempt <on|off>\n"
+               "            on: under sjf and balanced, when every worker is busy a\n"
+               "            much shorter job pauses the running job with the most\n"
+               "            time left, which resumes later (exec piper mode only)\n"
+               "        memcap:\n"
+               "            usage: memcap <jobs> <megabytes> | memcap off\n"
+               "            runs at most that many jobs at once whose peak memory,\n"
+               "            predicted from earlier jobs of similar size, reaches\n"
+               "            megabytes. other jobs go ahead of held back ones\n"
+               "        piper:\n"
+               "            usage: piper <exec|pool>\n"
+               "            exec starts a new piper for every job (default)\n"
+               "            pool keeps one warm piper per worker thread\n"
+               "        quit:\n"
+               "            usage: quit\n"
+               "            gracefully exits, a daemon client only closes its connection\n");
+    }
+
+    // unknown command
+    else {
+        fprintf(reply, "jobsched: command \"%s\" not found. Try \"help\".\n", word_one);
+    }
+    return 0;
+}
+
+int main (int argc, char ** argv) {
+    reply = stdout;
+    if (argc != 1 && (argc != 3 || strcmp(argv[1], "--daemon"))) {
+        printf("jobsched: USAGE: ./jobsched [--daemon <socket>]\n");
+        return 1;
+    }
+
+    // a piper that dies in pool mode should be an error, not kill jobsched
+    // and neither should a daemon client that goes away
+    signal(SIGPIPE, SIG_IGN);
+
+    // in daemon mode commands come from clients of a unix socket
+    int listen_fd = -1;
+    struct stat made;
+    if (argc == 3) {
+        listen_fd = daemon_socket(argv[2], &made);
+        if (listen_fd < 0) return 1;
+        // blocked before any thread starts, the command loop reads them
+        sigset_t stop;
+        sigemptyset(&stop);
+        sigaddset(&stop, SIGINT);
+        sigaddset(&stop, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &stop, NULL);
+        printf("jobsched: listening on %s\n", argv[2]);
+        fflush(stdout);
+    }
+
+    // head of the linked list
+    Job_list * queue = malloc(sizeof(Job_list));
+    queue->head = NULL;
+    queue->tail = NULL;
+    queue->last_job_id = 0;
+    queue->ingress = NULL;
+    queue->enqueue_ns = 0;
+    queue->enqueue_jobs = 0;
+    queue->drains = 0;
+    queue->drained = 0;
+    queue->total_output_size = 0;
+    memset(&queue->totals, 0, sizeof(Totals));
+    queue->output_budget = (size_t) OUTPUT_BUDGET_MB << 20;
+    // outputs are only ever removed by delete unless budget asks otherwise
+    queue->evict = 's';
+    heap_init(&queue->outputs, HEAP_DONE, by_last_use);
+    queue->evictions = 0;
+    queue->evicted_bytes = 0;
+    queue->pinned = 0;
+    queue->victims = NULL;
+    queue->nvictims = 0;
+    queue->victims_cap = 0;
+    queue->done = 0;
+    queue->count = 0;
+    queue->waiting = 0;
+    queue->runq = NULL;
+    queue->nrunq = 0;
+    queue->next_runq = 0;
+    queue->dispatch = 's';
+    queue->sched_ns = 0;
+    queue->sched_jobs = 0;
+    queue->min_workers = 0;
+    queue->max_workers = 0;
+    queue->live_workers = 0;
+    queue->threads = 0;
+    queue->stopping = 0;
+    queue->idle_workers = 0;
+    queue->next_worker_id = 0;
+    queue->recent_response = 0;
+    queue->recent_run = 0;
+    queue->all_waiters = 0;
+    queue->wake_fd = -1;
+    queue->launch = 'e';
+    queue->spawns = 0;
+    queue->batches = 0;
+    for (int i = 0; i < POLICIES; i++) {
+        queue->batch_bytes[i] = 0;
+        queue->batch_jobs[i] = 0;
+    }
+    queue->mode = 'f';
+    queue->preempt = 0;
+    queue->split_bytes = 0;
+    queue->nrunning = 0;
+    queue->shutdown = 0;
+    queue->preemptions = 0;
+    heap_init(&queue->paused, HEAP_PAUSED, by_remaining);
+    queue->index = NULL;
+    queue->index_cap = 0;
+    queue->predict = 0;
+    model_init(&queue->model);
+    cache_load(&queue->cache);
+    memset(queue->response_hist, 0, sizeof(queue->response_hist));
+    memset(queue->turnaround_hist, 0, sizeof(queue->turnaround_hist));
+    memset(queue->paused_hist, 0, sizeof(queue->paused_hist));
+    memset(queue->deadline_jobs, 0, sizeof(queue->deadline_jobs));
+    memset(queue->deadline_missed, 0, sizeof(queue->deadline_missed));
+    queue->ntenants = 0;
+    queue->vtime = 0;
+    tenant_find(queue, DEFAULT_TENANT, 1);
+    memset(queue->first_audio_hist, 0, sizeof(queue->first_audio_hist));
+    memset(queue->cpu_hist, 0, sizeof(queue->cpu_hist));
+    memset(queue->rss_hist, 0, sizeof(queue->rss_hist));
+    memset(queue->io_hist, 0, sizeof(queue->io_hist));
+    queue->rss_n = queue->rss_sx = queue->rss_sy = queue->rss_sxx = queue->rss_sxy = 0;
+    queue->heavy_kb = 0;
+    queue->stream = 0;
+    queue->sample_rate = model_sample_rate(PIPER_MODEL);
+    struct timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+    queue->wall_offset = wall.tv_sec * 1000000000ull + wall.tv_nsec - now_ns();
+    runq_init(&queue->shared, queue->mode, queue->predict);
+    
+    queue->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (queue->wake_fd < 0) {
+        printf("jobsched: unable to set up the command loop: %s\n", strerror(errno));
+        return 1;
+    }
+    command_loop(queue, listen_fd);
+
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        // the path may be another daemon's socket by now
+        struct stat st;
+        if (lstat(argv[2], &st) == 0 && st.st_dev == made.st_dev && st.st_ino == made.st_ino) {
+            unlink(argv[2]);
+        }
+    }
     delete_queue(queue);
-    free(input);
-    free(words);
 }
+
@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*
+loadgen - measures submit latency against a jobsched daemon as the number
+of connected clients grows. Every client is a thread with its own
+connection that sends submit commands back to back and times each one from
+sending the command to reading the "." line that ends its reply. All the
+clients of a round connect before any of them submits.
+
+start the daemon first, for example with the fake piper:
+    ./jobsched --daemon jobsched.sock
+    ./loadgen jobsched.sock test.txt
+
+usage: ./loadgen <socket> <file> [submits per client] [client counts...]
+*/
+
+typedef struct {
+    char * socket_path;
+    char * file;
+    int submits;
+    int fd;
+    // microseconds for each submit
+    double * latencies;
+    int failed;
+} Client;
+
+pthread_barrier_t start_line;
+
+double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+int connect_daemon(char * path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int read_reply(int fd, char * buffer, size_t * len, size_t size) {
+    // read up to and including the line with one dot, buffer keeps the rest
+    while (1) {
+        for (size_t i = 0; i + 1 < *len; i++) {
+            if ((i == 0 || buffer[i - 1] == '\n') && buffer[i] == '.' && buffer[i + 1] == '\n') {
+                memmove(buffer, buffer + i + 2, *len - i - 2);
+                *len -= i + 2;
+                return 0;
+            }
+        }
+        // nothing a submit prints needs the whole buffer, keep the tail
+        if (*len == size) {
+            memmove(buffer, buffer + size / 2, size - size / 2);
+            *len = size - size / 2;
+        }
+        ssize_t n = read(fd, buffer + *len, size - *len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        *len += n;
+    }
+}
+
+void * run_client(void * arg) {
+    Client * client = arg;
+    char command[512];
+    char buffer[4096];
+    size_t len = 0;
+    int length = snprintf(command, sizeof(command), "submit %s\n", client->file);
+
+    pthread_barrier_wait(&start_line);
+    for (int i = 0; i < client->submits && !client->failed; i++) {
+        double start = now_us();
+        if (write(client->fd, command, length) != length
+                || read_reply(client->fd, buffer, &len, sizeof(buffer)) < 0) {
+            client->failed = 1;
+            break;
+        }
+        client->latencies[i] = now_us() - start;
+    }
+    return NULL;
+}
+
+int by_value(const void * a, const void * b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+int run_round(char * socket_path, char * file, int clients, int submits) {
+    // one row of the table, every client connected for the whole round
+    Client * list = calloc(clients, sizeof(Client));
+    pthread_t * threads = malloc(clients * sizeof(pthread_t));
+    double * latencies = malloc((size_t) clients * submits * sizeof(double));
+    int connected = 0;
+    for (; connected < clients; connected++) {
+        Client * client = &list[connected];
+        client->socket_path = socket_path;
+        client->file = file;
+        client->submits = submits;
+        client->latencies = latencies + (size_t) connected * submits;
+        client->fd = connect_daemon(socket_path);
+        if (client->fd < 0) {
+            printf("loadgen: unable to connect to %s: %s\n", socket_path, strerror(errno));
+            break;
+        }
+    }
+
+    int failed = connected < clients;
+    if (!failed) {
+        pthread_barrier_init(&start_line, NULL, clients + 1);
+        for (int i = 0; i < clients; i++) pthread_create(&threads[i], NULL, run_client, &list[i]);
+        pthread_barrier_wait(&start_line);
+        double start = now_us();
+        for (int i = 0; i < clients; i++) pthread_join(threads[i], NULL);
+        double elapsed = now_us() - start;
+        pthread_barrier_destroy(&start_line);
+
+        for (int i = 0; i < clients; i++) failed |= list[i].failed;
+        if (failed) {
+            printf("loadgen: the daemon closed a connection during the round\n");
+        }
+        else {
+            size_t total = (size_t) clients * submits;
+            qsort(latencies, total, sizeof(double), by_value);
+            double sum = 0;
+            for (size_t i = 0; i < total; i++) sum += latencies[i];
+            printf("%-9d%-10zu%-12.0f%-10.1f%-10.1f%-10.1f%-10.1f\n", clients, total
+                    , total / (elapsed / 1e6), sum / total, latencies[total / 2]
+                    , latencies[total * 99 / 100], latencies[total - 1]);
+            fflush(stdout);
+        }
+    }
+
+    for (int i = 0; i < connected; i++) close(list[i].fd);
+    free(list);
+    free(threads);
+    free(latencies);
+    return failed ? -1 : 0;
+}
+
+int main(int argc, char ** argv) {
+    int submits = argc > 3 ? atoi(argv[3]) : 20;
+    int default_clients[] = {1, 10, 100, 300};
+    int rounds = argc > 4 ? argc - 4 : 4;
+    int * clients = default_clients;
+    if (argc > 4) {
+        clients = malloc(rounds * sizeof(int));
+        for (int i = 0; i < rounds; i++) clients[i] = atoi(argv[i + 4]);
+    }
+    for (int i = 0; i < rounds; i++) {
+        if (clients[i] <= 0) submits = 0;
+    }
+    if (argc < 3 || submits <= 0) {
+        printf("loadgen: USAGE: ./loadgen <socket> <file> [submits per client] [client counts...]\n");
+        return 1;
+    }
+
+    int failed = 0;
+    printf("CLIENTS  SUBMITS   SUBMITS_S   MEAN_US   P50_US    P99_US    MAX_US\n");
+    for (int i = 0; i < rounds; i++) {
+        if (run_round(argv[1], argv[2], clients[i], submits) < 0) failed++;
+    }
+    if (clients != default_clients) free(clients);
+    return failed ? 1 : 0;
+}
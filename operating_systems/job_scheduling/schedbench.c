@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+#include <spawn.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+/*
+schedbench - compares the jobsched scheduling policies on synthetic job
+mixes. Every run starts a fresh jobsched in bench_run/, where piper/piper
+is a link to fakepiper, and feeds it submit commands at generated arrival
+times. The same jobs and arrivals are replayed for every policy and worker
+count, so the rows of one mix are directly comparable.
+
+mixes:
+    uniform     input sizes uniform, poisson arrivals
+    heavytail   pareto input sizes (a few very long jobs), poisson arrivals
+    bursty      uniform input sizes, arrivals in poisson bursts with idle gaps
+
+Arrival rates are set so the workers are about 80% busy on average.
+
+usage: ./schedbench [jobs per run] [worker counts...]
+*/
+
+extern char ** environ;
+
+#define RUN_DIR "bench_run"
+#define MAX_SIZE 30000
+#define LOAD 0.8
+
+// fakepiper settings, small so a full sweep takes about a minute
+#define LOAD_US 5000
+#define US_PER_BYTE 10
+
+char * mix_names[] = {"uniform", "heavytail", "bursty"};
+char * policy_names[] = {"fcfs", "sjf", "balanced"};
+
+typedef struct {
+    double jobs_per_s;
+    double mean_response_ms;
+    double p50_ms;
+    double p90_ms;
+    double p99_ms;
+    double max_ms;
+    double overhead_us;
+} Result;
+
+double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+double uniform01(void) {
+    // in (0, 1) so logs and powers are safe
+    return (random() + 1.0) / (RAND_MAX + 2.0);
+}
+
+double exponential(double mean) {
+    return -mean * log(uniform01());
+}
+
+size_t job_size(int mix) {
+    // input bytes of one generated job
+    if (mix == 1) {
+        // pareto, alpha 1.5 and minimum 300 bytes, mean about 900
+        double size = 300 / pow(uniform01(), 1 / 1.5);
+        return size > MAX_SIZE ? MAX_SIZE : size;
+    }
+    return 200 + random() % 2800;
+}
+
+void make_arrivals(int mix, double * arrivals, int jobs, double mean_gap) {
+    // seconds after the start of the run that each job is submitted
+    double t = 0;
+    for (int i = 0; i < jobs; i++) {
+        arrivals[i] = t;
+        if (mix != 2) {
+            t += exponential(mean_gap);
+            continue;
+        }
+        // bursts of about ten jobs close together, then a long gap
+        // so the average rate matches the other mixes
+        if (random() % 10 == 0) {
+            t += exponential(mean_gap * 9.1);
+        }
+        else {
+            t += exponential(mean_gap / 10);
+        }
+    }
+}
+
+int write_input(int i, size_t size) {
+    // text with words and sentences so jobsched's features are realistic
+    char name[64];
+    snprintf(name, sizeof(name), "in%d.txt", i);
+    FILE * file = fopen(name, "w");
+    if (!file) return -1;
+    for (size_t n = 0; n < size; n++) {
+        int r = random() % 64;
+        char c = r < 9 ? ' ' : r == 9 ? '.' : r == 10 ? ',' : 'a' + r % 26;
+        fputc(n + 1 == size ? '\n' : c, file);
+    }
+    fclose(file);
+    return 0;
+}
+
+int setup_run_dir(char * fakepiper) {
+    // piper/piper and arctic.onnx as jobsched expects to find them
+    mkdir(RUN_DIR, 0755);
+    if (chdir(RUN_DIR) < 0) {
+        printf("schedbench: unable to enter %s: %s\n", RUN_DIR, strerror(errno));
+        return -1;
+    }
+    mkdir("piper", 0755);
+    unlink("piper/piper");
+    if (symlink(fakepiper, "piper/piper") < 0) {
+        printf("schedbench: unable to link fakepiper: %s\n", strerror(errno));
+        return -1;
+    }
+    int model = open("arctic.onnx", O_WRONLY | O_CREAT, 0644);
+    if (model >= 0) close(model);
+    return 0;
+}
+
+void remove_outputs(int jobs) {
+    char name[64];
+    for (int i = 1; i <= jobs; i++) {
+        snprintf(name, sizeof(name), "job%d.wav", i);
+        unlink(name);
+    }
+}
+
+void sleep_until(double t) {
+    double left = t - now_s();
+    if (left <= 0) return;
+    struct timespec ts = { (time_t) left, (long) ((left - (time_t) left) * 1e9) };
+    nanosleep(&ts, NULL);
+}
+
+int parse_output(char * path, char * policy, Result * result) {
+    // pick the numbers out of jobsched's list and stats output
+    FILE * file = fopen(path, "r");
+    if (!file) return -1;
+    char line[512];
+    int found = 0;
+    while (fgets(line, sizeof(line), file)) {
+        double value;
+        char name[32], metric[32];
+        unsigned long count;
+        double p50, p90, p99, max;
+        if (sscanf(line, "Scheduler overhead: %lf", &value) == 1) {
+            result->overhead_us = value;
+        }
+        else if (sscanf(line, "Average response time: %lf", &value) == 1) {
+            result->mean_response_ms = value * 1e3;
+            found++;
+        }
+        else if (sscanf(line, "%31s %31s %lu %lf %lf %lf %lf", name, metric, &count
+                    , &p50, &p90, &p99, &max) == 7
+                && !strcmp(name, policy) && !strcmp(metric, "response")) {
+            result->p50_ms = p50;
+            result->p90_ms = p90;
+            result->p99_ms = p99;
+            result->max_ms = max;
+            found++;
+        }
+    }
+    fclose(file);
+    return found == 2 ? 0 : -1;
+}
+
+int run_once(char * jobsched, char * policy, int workers, double * arrivals, int jobs, Result * result) {
+    // one jobsched process from first submit to exit
+    int fds[2];
+    if (pipe(fds) < 0) {
+        printf("schedbench: unable to create pipe: %s\n", strerror(errno));
+        return -1;
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[0], STDIN_FILENO);
+    posix_spawn_file_actions_addclose(&actions, fds[0]);
+    posix_spawn_file_actions_addclose(&actions, fds[1]);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "out.txt", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+
+    char * args[] = {"jobsched", NULL};
+    pid_t pid;
+    int err = posix_spawn(&pid, jobsched, &actions, NULL, args, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[0]);
+    if (err != 0) {
+        printf("schedbench: unable to start jobsched: %s\n", strerror(err));
+        close(fds[1]);
+        return -1;
+    }
+
+    FILE * in = fdopen(fds[1], "w");
+    fprintf(in, "waitmode block\ncache off\nschedule %s\nnthreads %d\n", policy, workers);
+    fflush(in);
+
+    double start = now_s();
+    for (int i = 0; i < jobs; i++) {
+        sleep_until(start + arrivals[i]);
+        fprintf(in, "submit in%d.txt\n", i);
+        fflush(in);
+    }
+    fprintf(in, "waitall\nlist\nstats\nquit\n");
+    fclose(in);
+
+    int status;
+    waitpid(pid, &status, 0);
+    result->jobs_per_s = jobs / (now_s() - start);
+    remove_outputs(jobs);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        printf("schedbench: jobsched did not exit cleanly, see %s/out.txt\n", RUN_DIR);
+        return -1;
+    }
+    if (parse_output("out.txt", policy, result) < 0) {
+        printf("schedbench: unable to read results, see %s/out.txt\n", RUN_DIR);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char ** argv) {
+    int jobs = argc > 1 ? atoi(argv[1]) : 100;
+    int default_workers[] = {1, 2, 4};
+    int nworkers = argc > 2 ? argc - 2 : 3;
+    int * workers = default_workers;
+    if (argc > 2) {
+        workers = malloc(nworkers * sizeof(int));
+        for (int i = 0; i < nworkers; i++) workers[i] = atoi(argv[i + 2]);
+    }
+    for (int i = 0; i < nworkers; i++) {
+        if (workers[i] <= 0) jobs = 0;
+    }
+    if (jobs <= 0) {
+        printf("schedbench: USAGE: ./schedbench [jobs per run] [worker counts...]\n");
+        return 1;
+    }
+
+    char jobsched[PATH_MAX], fakepiper[PATH_MAX];
+    if (!realpath("jobsched", jobsched) || !realpath("fakepiper", fakepiper)) {
+        printf("schedbench: build jobsched and fakepiper first (make bench)\n");
+        return 1;
+    }
+    if (setup_run_dir(fakepiper) < 0) return 1;
+
+    char value[32];
+    snprintf(value, sizeof(value), "%d", LOAD_US);
+    setenv("FAKEPIPER_LOAD_US", value, 1);
+    snprintf(value, sizeof(value), "%d", US_PER_BYTE);
+    setenv("FAKEPIPER_US_BYTE", value, 1);
+    setenv("FAKEPIPER_SAMPLES", "2", 1);
+
+    double * arrivals = malloc(jobs * sizeof(double));
+    size_t * sizes = malloc(jobs * sizeof(size_t));
+    int failed = 0;
+
+    printf("MIX        POLICY    WORKERS  JOBS_S   MEAN_MS   P50_MS    P90_MS    P99_MS    MAX_MS    OVERHEAD_US\n");
+    for (int mix = 0; mix < 3; mix++) {
+        // one workload per mix, replayed for every policy and worker count
+        srandom(mix + 1);
+        size_t total = 0;
+        for (int i = 0; i < jobs; i++) {
+            sizes[i] = job_size(mix);
+            total += sizes[i];
+            if (write_input(i, sizes[i]) < 0) {
+                printf("schedbench: unable to write input %d: %s\n", i, strerror(errno));
+                return 1;
+            }
+        }
+        double mean_service = (LOAD_US + US_PER_BYTE * (double) total / jobs) / 1e6;
+
+        for (int w = 0; w < nworkers; w++) {
+            srandom(mix * 1000 + workers[w]);
+            make_arrivals(mix, arrivals, jobs, mean_service / (LOAD * workers[w]));
+            for (int p = 0; p < 3; p++) {
+                Result result = {0};
+                if (run_once(jobsched, policy_names[p], workers[w], arrivals, jobs, &result) < 0) {
+                    failed++;
+                    continue;
+                }
+                printf("%-11s%-10s%-9d%-9.1f%-10.2f%-10.2f%-10.2f%-10.2f%-10.2f%.2f\n"
+                        , mix_names[mix], policy_names[p], workers[w], result.jobs_per_s
+                        , result.mean_response_ms, result.p50_ms, result.p90_ms
+                        , result.p99_ms, result.max_ms, result.overhead_us);
+                fflush(stdout);
+            }
+        }
+    }
+
+    for (int i = 0; i < jobs; i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "in%d.txt", i);
+        unlink(name);
+    }
+    free(arrivals);
+    free(sizes);
+    if (workers != default_workers) free(workers);
+    return failed ? 1 : 0;
+}
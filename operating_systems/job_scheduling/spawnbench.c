@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <spawn.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+/*
+spawnbench - measures how long it takes jobsched to launch a child as the
+queue grows. The queue is simulated with one heap allocation per job, about
+the size of a Job plus its strings, and every page is touched so it is
+really mapped. Each child is /bin/true with the same redirections jobsched
+uses for piper.
+
+usage: ./spawnbench [launches per point]
+*/
+
+extern char ** environ;
+
+// roughly what one submitted job costs on the heap
+#define JOB_BYTES 256
+
+double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+pid_t launch_fork(void) {
+    // the old fork, dup2, exec sequence
+    pid_t pid = fork();
+    if (pid == 0) {
+        int file = open("/dev/null", O_RDONLY);
+        dup2(file, STDIN_FILENO);
+        close(file);
+        file = open("/dev/null", O_WRONLY);
+        dup2(file, STDOUT_FILENO);
+        dup2(file, STDERR_FILENO);
+        close(file);
+        execl("/bin/true", "true", NULL);
+        _exit(127);
+    }
+    return pid;
+}
+
+pid_t launch_spawn(void) {
+    // posix_spawn with the redirections done as file actions
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+
+    char * args[] = {"true", NULL};
+    pid_t pid;
+    int err = posix_spawn(&pid, "/bin/true", &actions, NULL, args, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return pid;
+}
+
+double time_launches(pid_t (*launch)(void), int launches) {
+    // average microseconds from launch to reaping the child
+    double start = now_us();
+    for (int i = 0; i < launches; i++) {
+        pid_t pid = launch();
+        if (pid < 0) {
+            printf("spawnbench: launch failed: %s\n", strerror(errno));
+            exit(1);
+        }
+        int status;
+        waitpid(pid, &status, 0);
+    }
+    return (now_us() - start) / launches;
+}
+
+int main(int argc, char ** argv) {
+    int launches = argc > 1 ? atoi(argv[1]) : 200;
+    if (launches <= 0) {
+        printf("spawnbench: USAGE: ./spawnbench [launches per point]\n");
+        return 1;
+    }
+
+    size_t sizes[] = {0, 10000, 100000, 1000000, 4000000};
+    size_t points = sizeof(sizes) / sizeof(sizes[0]);
+
+    char ** jobs = malloc(sizes[points - 1] * sizeof(char *));
+    size_t allocated = 0;
+
+    printf("QUEUED_JOBS  HEAP_MB  FORK_US   SPAWN_US\n");
+    for (size_t p = 0; p < points; p++) {
+        // grow the fake queue to the next size
+        for (; allocated < sizes[p]; allocated++) {
+            jobs[allocated] = malloc(JOB_BYTES);
+            memset(jobs[allocated], 1, JOB_BYTES);
+        }
+        double fork_us = time_launches(launch_fork, launches);
+        double spawn_us = time_launches(launch_spawn, launches);
+        printf("%-13zu%-9zu%-10.1f%-10.1f\n", sizes[p]
+                , sizes[p] * JOB_BYTES >> 20, fork_us, spawn_us);
+    }
+
+    for (size_t i = 0; i < allocated; i++) free(jobs[i]);
+    free(jobs);
+    return 0;
+}